@@ -84,4 +84,26 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Fill a cache with new coins, read them back, then flush it to its parent
+// cache and flush that, which releases all of the parent's memory.
+static void CCoinsCacheFillFlush(benchmark::State& state)
+{
+    const int nCoins = 10000;
+    CCoinsView coinsDummy;
+    CCoinsViewCache base(&coinsDummy);
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+    uint256 txid;
+    while (state.KeepRunning()) {
+        CCoinsViewCache coins(&base);
+        for (int i = 0; i < nCoins; i++) {
+            txid = Hash(txid.begin(), txid.end());
+            coins.AddCoin(COutPoint(txid, i % 4), Coin(CTxOut(i, script), 1, false), false);
+        }
+        assert(coins.GetCacheSize() == nCoins);
+        coins.Flush();
+        base.Flush();
+    }
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsCacheFillFlush);
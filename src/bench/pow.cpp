@@ -0,0 +1,189 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "checkqueue.h"
+#include "miner.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+#include "validation.h"
+
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+static CBlockHeader BenchHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1516252661;
+    header.nBits = 0x1e0ffff0;
+    return header;
+}
+
+// One yespower_tls() call with the mainnet parameters, as used for every
+// header we accept. See PoWCheckHeaders for the multi-threaded rate.
+static void YespowerHash(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    while (state.KeepRunning()) {
+        header.GetHashYespower();
+        header.nNonce++;
+    }
+}
+
+// Header as received off the wire: deserialize the 80 bytes and hash them
+static void DeserializeAndHashHeader(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << BenchHeader();
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    while (state.KeepRunning()) {
+        CBlockHeader header;
+        stream >> header;
+        header.GetHashYespower();
+        assert(stream.Rewind(BLOCK_HEADER_SIZE));
+    }
+}
+
+static void CheckProofOfWorkBench(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const uint256 hash = uint256S("0x00000d2f6e9b5c8b1a3c4f7e0d9a8b7c6d5e4f3a2b1c0d9e8f7a6b5c4d3e2f1a");
+    while (state.KeepRunning()) {
+        CheckProofOfWork(hash, 0x1e0ffff0, params);
+    }
+}
+
+// Retarget with DarkGravityWave at every height of a long synthetic chain. The
+// result cached in the CBlockIndex is cleared first, so every iteration does
+// the full retarget; DarkGravityWaveHeaderSync covers the cached lookups.
+static void DarkGravityWaveRetarget(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+
+    const size_t nChainLength = 100000;
+    std::vector<CBlockIndex> vBlocks(nChainLength);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : nullptr;
+        vBlocks[i].nHeight = i;
+        // Alternate fast and slow blocks so the retarget has work to do
+        vBlocks[i].nTime = i ? vBlocks[i - 1].nTime + (i % 2 ? 90 : 210) : 1516252661;
+        vBlocks[i].nBits = 0x1e0ffff0;
+    }
+
+    size_t nHeight = 0;
+    while (state.KeepRunning()) {
+        vBlocks[nHeight].nNextWorkRequired = 0;
+        GetNextWorkRequired(&vBlocks[nHeight], nullptr, params);
+        if (++nHeight == vBlocks.size()) nHeight = 0;
+    }
+}
+
+// Header sync over a 1M-header chain: every iteration accepts one new header,
+// whose nBits is checked against the retarget of its parent, and then asks for
+// the retarget again the way UpdateTime and block template creation do.
+static void DarkGravityWaveHeaderSync(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+
+    const size_t nChainLength = 1000000;
+    std::vector<CBlockIndex> vBlocks;
+    vBlocks.reserve(nChainLength);
+    while (state.KeepRunning()) {
+        if (vBlocks.empty() || vBlocks.size() == nChainLength) {
+            vBlocks.clear();
+            vBlocks.emplace_back();
+            vBlocks.back().nTime = 1516252661;
+            vBlocks.back().nBits = UintToArith256(params.powLimit).GetCompact();
+        }
+        const CBlockIndex& prev = vBlocks.back();
+        CBlockIndex header;
+        header.pprev = const_cast<CBlockIndex*>(&prev);
+        header.nHeight = prev.nHeight + 1;
+        header.nTime = prev.nTime + (header.nHeight % 2 ? 90 : 210);
+        header.nBits = GetNextWorkRequired(&prev, nullptr, params);
+        GetNextWorkRequired(&prev, nullptr, params);
+        GetNextWorkRequired(&prev, nullptr, params);
+        vBlocks.push_back(header);
+    }
+}
+
+// Every iteration hashes HEADERS_PER_BATCH headers, so the header
+// verification rate is HEADERS_PER_BATCH / average.
+static const size_t HEADERS_PER_BATCH = 64;
+
+static void PoWCheckHeaders(benchmark::State& state, int nThreads)
+{
+    std::vector<CBlockHeader> vHeaders(HEADERS_PER_BATCH);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].nVersion = 4;
+        vHeaders[i].nTime = 1516252661 + i * 150;
+        vHeaders[i].nBits = 0x1e0ffff0;
+        vHeaders[i].nNonce = i;
+    }
+    std::vector<uint256> vHashPoW(vHeaders.size());
+
+    CCheckQueue<CPoWCheck> queue(4);
+    boost::thread_group tg;
+    // The thread running the benchmark joins the pool as the master
+    for (int i = 0; i < nThreads - 1; i++) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CPoWCheck> control(nThreads > 1 ? &queue : nullptr);
+        std::vector<CPoWCheck> vChecks;
+        vChecks.reserve(vHeaders.size());
+        for (size_t i = 0; i < vHeaders.size(); i++) {
+            vChecks.emplace_back(vHeaders[i], &vHashPoW[i]);
+        }
+        if (nThreads > 1) {
+            control.Add(vChecks);
+        } else {
+            for (CPoWCheck& check : vChecks) check();
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void PoWCheckHeaders_1Thread(benchmark::State& state) { PoWCheckHeaders(state, 1); }
+static void PoWCheckHeaders_2Threads(benchmark::State& state) { PoWCheckHeaders(state, 2); }
+static void PoWCheckHeaders_4Threads(benchmark::State& state) { PoWCheckHeaders(state, 4); }
+static void PoWCheckHeaders_AllCores(benchmark::State& state) { PoWCheckHeaders(state, GetNumCores()); }
+
+// Hash one nonce per iteration with the allocation-free mining kernel
+static void YespowerScanner(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+
+    CYespowerScanner scanner;
+    scanner.SetHeader(header);
+    uint256 hash;
+    uint32_t nNonce = 0;
+    while (state.KeepRunning()) {
+        scanner.Hash(nNonce++, hash);
+    }
+}
+
+BENCHMARK(YespowerHash);
+BENCHMARK(DeserializeAndHashHeader);
+BENCHMARK(CheckProofOfWorkBench);
+BENCHMARK(DarkGravityWaveRetarget);
+BENCHMARK(DarkGravityWaveHeaderSync);
+BENCHMARK(PoWCheckHeaders_1Thread);
+BENCHMARK(PoWCheckHeaders_2Threads);
+BENCHMARK(PoWCheckHeaders_4Threads);
+BENCHMARK(PoWCheckHeaders_AllCores);
+BENCHMARK(YespowerScanner);
@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "chain.h"
+#include "consensus/consensus.h"
+#include "crypto/common.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileMap::Map(const fs::path& path, size_t nMinSize)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lruFiles.begin();
+    while (it != lruFiles.end() && it->first != path.string())
+        ++it;
+
+    if (it != lruFiles.end()) {
+        lruFiles.splice(lruFiles.begin(), lruFiles, it);
+        if (it->second->size() >= nMinSize)
+            return it->second;
+    }
+
+    // Not mapped yet, or the read is past the end of the mapping
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        if (it != lruFiles.end())
+            lruFiles.erase(it);
+        return nullptr;
+    }
+    struct stat st;
+    size_t nFileSize = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    if (nFileSize == 0 || nFileSize < nMinSize) {
+        close(fd);
+        // Past the end of the file. If it got shorter than the old mapping,
+        // reading that would raise SIGBUS, so drop it.
+        if (it != lruFiles.end() && nFileSize < it->second->size())
+            lruFiles.erase(it);
+        return nullptr;
+    }
+    void* pdata = mmap(nullptr, nFileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pdata == MAP_FAILED) {
+        LogPrintf("%s: unable to map %s\n", __func__, path.string());
+        return nullptr;
+    }
+
+    auto file = std::make_shared<const CMappedBlockFile>(static_cast<const char*>(pdata), nFileSize);
+    if (it != lruFiles.end()) {
+        it->second = file;
+    } else {
+        lruFiles.emplace_front(path.string(), file);
+        if (lruFiles.size() > nMaxFiles)
+            lruFiles.pop_back();
+    }
+    return file;
+#endif
+}
+
+bool CBlockFileMap::Get(const fs::path& path, const CDiskBlockPos& pos, size_t nSize, CBlockFileSpan& span)
+{
+    std::shared_ptr<const CMappedBlockFile> file = Map(path, (size_t)pos.nPos + nSize);
+    if (!file)
+        return false;
+    span.file = file;
+    span.pbegin = file->data() + pos.nPos;
+    span.nSize = nSize;
+    return true;
+}
+
+bool CBlockFileMap::GetBlock(const fs::path& path, const CDiskBlockPos& pos, CBlockFileSpan& span)
+{
+    // Blocks are stored after the message start and their size
+    if (pos.nPos < 8)
+        return false;
+    CBlockFileSpan spanSize;
+    if (!Get(path, CDiskBlockPos(pos.nFile, pos.nPos - 4), 4, spanSize))
+        return false;
+    uint32_t nSize = ReadLE32(reinterpret_cast<const unsigned char*>(spanSize.pbegin));
+    if (nSize == 0 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+        return false;
+    return Get(path, pos, nSize, span);
+}
+
+void CBlockFileMap::Invalidate(const fs::path& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lruFiles.remove_if([&](const std::pair<std::string, std::shared_ptr<const CMappedBlockFile>>& entry) { return entry.first == path.string(); });
+}
+
+void CBlockFileMap::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lruFiles.clear();
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "fs.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct CDiskBlockPos;
+
+/** Number of block files kept mapped at a time */
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 8 : 2;
+
+/** A read only memory mapping of a whole blk?????.dat file */
+class CMappedBlockFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+public:
+    CMappedBlockFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile();
+
+    CMappedBlockFile(const CMappedBlockFile&) = delete;
+    CMappedBlockFile& operator=(const CMappedBlockFile&) = delete;
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/** A range of bytes in a mapped block file, which stays mapped while this exists */
+struct CBlockFileSpan
+{
+    std::shared_ptr<const CMappedBlockFile> file;
+    const char* pbegin;
+    size_t nSize;
+
+    CBlockFileSpan() : pbegin(nullptr), nSize(0) {}
+};
+
+/**
+ * A small pool of memory mapped block files, used to read stored blocks
+ * without a system call and a copy through stdio for each of them. The least
+ * recently used file is unmapped when the pool is full; spans handed out keep
+ * their file mapped until they are destroyed.
+ *
+ * Files that are appended to are mapped again when a read goes past the end
+ * of the current mapping. Files that get truncated or deleted must be
+ * invalidated first. Mapping is not available on Windows, where every lookup
+ * fails and callers fall back to reading the file.
+ *
+ * Lookups within the current mapping don't touch the file. Reading a mapped
+ * page past the end of the file raises SIGBUS, so a blk?????.dat file
+ * truncated by something else while it is mapped can still kill the node.
+ * The size of the file is only checked again when a lookup goes past the end
+ * of the mapping: if the file no longer covers the range the lookup fails,
+ * leaving the caller to read it with stdio and report the error, and if it
+ * has become shorter than the mapping, that is dropped.
+ */
+class CBlockFileMap
+{
+private:
+    std::mutex mutex;
+    //! Mapped files by path, most recently used first
+    std::list<std::pair<std::string, std::shared_ptr<const CMappedBlockFile>>> lruFiles;
+    const size_t nMaxFiles;
+
+    std::shared_ptr<const CMappedBlockFile> Map(const fs::path& path, size_t nMinSize);
+
+public:
+    explicit CBlockFileMap(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    //! Get the nSize bytes at pos in the block file at path
+    bool Get(const fs::path& path, const CDiskBlockPos& pos, size_t nSize, CBlockFileSpan& span);
+    //! Get the serialized block at pos, using the size stored in front of it
+    bool GetBlock(const fs::path& path, const CDiskBlockPos& pos, CBlockFileSpan& span);
+
+    //! Drop the mapping of the file at path
+    void Invalidate(const fs::path& path);
+    //! Drop all mappings
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
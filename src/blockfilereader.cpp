@@ -0,0 +1,134 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "streams.h"
+#include "util.h"
+#include "validation.h"
+
+#include <string.h>
+
+//! Size of the chunks a block is copied out of the file buffer in
+static const size_t BLOCK_READ_CHUNK_SIZE = 1 << 16;
+
+CBlockFileReader::CBlockFileReader(const CMessageHeader::MessageStartChars& messageStartIn, int nFile, size_t nMaxQueuedBytesIn) : nMaxQueuedBytes(nMaxQueuedBytesIn), nQueuedBytes(0), fDone(false), fShutdown(false)
+{
+    memcpy(messageStart, messageStartIn, sizeof(messageStart));
+    thread = std::thread(&CBlockFileReader::Thread, this, nFile);
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fShutdown = true;
+    }
+    condRoom.notify_all();
+    thread.join();
+}
+
+void CBlockFileReader::Thread(int nFile)
+{
+    RenameThread("bitcoin-blkread");
+    for (; ; nFile++) {
+        CDiskBlockPos pos(nFile, 0);
+        if (!fs::exists(GetBlockPosFilename(pos, "blk")))
+            break; // No block files left
+        FILE* file = OpenBlockFile(pos, true);
+        if (!file)
+            break; // This error is logged in OpenBlockFile
+        try {
+            ReadFile(file, nFile);
+        } catch (const std::runtime_error& e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            strError = e.what();
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fShutdown)
+            break;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    fDone = true;
+    condReady.notify_all();
+}
+
+void CBlockFileReader::ReadFile(FILE* file, int nFile)
+{
+    // This takes over file and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(file, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(messageStart[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            Entry entry;
+            uint64_t nBlockPos = blkdat.GetPos();
+            entry.pos = CDiskBlockPos(nFile, nBlockPos);
+            blkdat.SetLimit(nBlockPos + nSize);
+            entry.vchBlock.resize(nSize);
+            for (size_t nDone = 0; nDone < nSize; nDone += BLOCK_READ_CHUNK_SIZE)
+                blkdat.read((char*)entry.vchBlock.data() + nDone, std::min<size_t>(nSize - nDone, BLOCK_READ_CHUNK_SIZE));
+            nRewind = blkdat.GetPos();
+            if (!Push(std::move(entry)))
+                return;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+bool CBlockFileReader::Push(Entry&& entry)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condRoom.wait(lock, [&]{ return fShutdown || queue.empty() || nQueuedBytes + entry.vchBlock.size() <= nMaxQueuedBytes; });
+    if (fShutdown)
+        return false;
+    nQueuedBytes += entry.vchBlock.size();
+    queue.push_back(std::move(entry));
+    condReady.notify_all();
+    return true;
+}
+
+bool CBlockFileReader::Read(std::vector<Entry>& vEntries, size_t nMax)
+{
+    vEntries.clear();
+    std::unique_lock<std::mutex> lock(mutex);
+    condReady.wait(lock, [&]{ return fDone || !queue.empty(); });
+    while (!queue.empty() && vEntries.size() < nMax) {
+        nQueuedBytes -= queue.front().vchBlock.size();
+        vEntries.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+    condRoom.notify_all();
+    return !vEntries.empty();
+}
+
+std::string CBlockFileReader::GetError()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return strError;
+}
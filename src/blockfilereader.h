@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEREADER_H
+#define BITCOIN_BLOCKFILEREADER_H
+
+#include "chain.h"
+#include "protocol.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Scans the block files blk?????.dat from a given one on, in order, on a
+ * background thread and hands out the serialized blocks found in them with
+ * their positions. Used by -reindex, so that reading the files overlaps with
+ * checking and accepting the blocks read before. At most nMaxQueuedBytes of
+ * blocks are read ahead.
+ */
+class CBlockFileReader
+{
+public:
+    struct Entry
+    {
+        CDiskBlockPos pos;
+        std::vector<unsigned char> vchBlock;
+    };
+
+private:
+    CMessageHeader::MessageStartChars messageStart;
+    const size_t nMaxQueuedBytes;
+
+    std::mutex mutex;
+    //! The reader thread waits on this for room in the queue
+    std::condition_variable condRoom;
+    //! Read() waits on this for blocks
+    std::condition_variable condReady;
+    std::deque<Entry> queue;
+    size_t nQueuedBytes;
+    bool fDone;
+    bool fShutdown;
+    std::string strError;
+    std::thread thread;
+
+    void Thread(int nFile);
+    void ReadFile(FILE* file, int nFile);
+    bool Push(Entry&& entry);
+
+public:
+    CBlockFileReader(const CMessageHeader::MessageStartChars& messageStartIn, int nFile, size_t nMaxQueuedBytesIn);
+    ~CBlockFileReader();
+
+    /**
+     * Move up to nMax of the next blocks into vEntries, waiting for at least
+     * one. Returns false once all files have been read.
+     */
+    bool Read(std::vector<Entry>& vEntries, size_t nMax);
+
+    //! The error that stopped reading early, if any
+    std::string GetError();
+};
+
+#endif // BITCOIN_BLOCKFILEREADER_H
@@ -160,6 +160,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_HAVE_POW_HASH     =   256, //!< hashPoW holds the yespower hash of the header, checked against nBits
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -213,12 +215,20 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    //! yespower hash of the block header. Only meaningful if nStatus has BLOCK_HAVE_POW_HASH set,
+    //! in which case the header has already passed CheckProofOfWork and never needs to be re-hashed.
+    uint256 hashPoW;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
 
     //! (memory only) Maximum nTime in the chain upto and including this block.
     unsigned int nTimeMax;
 
+    //! (memory only) nBits required of a child of this block, 0 until GetNextWorkRequired() computed it.
+    //! Guarded by cs_nextwork in pow.cpp.
+    mutable unsigned int nNextWorkRequired;
+
     void SetNull()
     {
         phashBlock = nullptr;
@@ -234,12 +244,14 @@ public:
         nStatus = 0;
         nSequenceId = 0;
         nTimeMax = 0;
+        nNextWorkRequired = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = uint256();
     }
 
     CBlockIndex()
@@ -405,6 +417,8 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        if (nStatus & BLOCK_HAVE_POW_HASH)
+            READWRITE(hashPoW);
     }
 
     uint256 GetBlockHash() const
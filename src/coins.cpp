@@ -34,7 +34,9 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &cacheCoinsMemoryResource),
+    cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -87,6 +89,15 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+void CCoinsViewCache::CacheCoinFromBase(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted)
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHash();
@@ -205,9 +216,49 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::Sync(CCoinsMap& mapCoins, bool fEvict) {
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = mapCoins[it->first];
+            entry.flags = it->second.flags;
+            if (fEvict)
+                entry.coin = std::move(it->second.coin);
+            else
+                entry.coin = it->second.coin;
+        }
+        if (fEvict) {
+            ++it;
+        } else if (it->second.coin.IsSpent()) {
+            // The base learns about the spend through mapCoins
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    if (fEvict) {
+        cacheCoins.clear();
+        cachedCoinsUsage = 0;
+        ReallocateCache();
+    }
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // Give the pool's chunks and the bucket array back in one go, instead of
+    // keeping the memory of the largest cache ever seen.
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &cacheCoinsMemoryResource);
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
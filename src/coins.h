@@ -12,11 +12,13 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
 #include <unordered_map>
 
 /**
@@ -119,7 +121,17 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap come from a pool, without a malloc header each and
+ * next to each other in memory. The largest pooled block leaves room for the
+ * node's next pointer and cached hash, plus some slack for other standard
+ * libraries.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4,
+                      alignof(void*)> CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -206,6 +218,8 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Backs the nodes of cacheCoins, so it must be declared before it. */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -243,6 +257,13 @@ public:
      */
     const Coin& AccessCoin(const COutPoint &output) const;
 
+    /**
+     * Add a coin that was read from the base view directly, unless the cache
+     * already has an entry for outpoint, which is newer. The base must not have
+     * been written to since the coin was read.
+     */
+    void CacheCoinFromBase(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Add a coin. Set potential_overwrite to true if a non-pruned version may
      * already exist.
@@ -263,6 +284,14 @@ public:
      */
     bool Flush();
 
+    /**
+     * Copy the modifications applied to this cache into mapCoins, for the
+     * caller to write to the base, and keep the entries here as unmodified
+     * ones so the cache stays warm. Spent entries are dropped. With fEvict all
+     * entries are moved out instead, leaving the cache empty like Flush().
+     */
+    void Sync(CCoinsMap& mapCoins, bool fEvict);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -291,6 +320,9 @@ public:
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 
+    //! Release the memory of the (empty) cache
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -0,0 +1,182 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+
+//! Number of outpoints a thread claims at a time
+static const size_t PREFETCH_BATCH_SIZE = 16;
+
+CCoinsPrefetcher::CCoinsPrefetcher(int nThreads) : nJob(0), nActive(0), fShutdown(false), pconsensusParams(nullptr), base(nullptr), fReady(false), fReading(false), nNextOutpoint(0), fCancel(false)
+{
+    for (int i = 0; i < std::max(1, nThreads); i++)
+        vThreads.emplace_back(&CCoinsPrefetcher::Thread, this);
+}
+
+CCoinsPrefetcher::~CCoinsPrefetcher()
+{
+    Cancel();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fShutdown = true;
+    }
+    condJob.notify_all();
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    RenameThread("bitcoin-prefetch");
+    uint64_t nLastJob = 0;
+    while (true) {
+        bool fRead = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condJob.wait(lock, [&]{ return fShutdown || nJob != nLastJob; });
+            if (fShutdown)
+                return;
+            nLastJob = nJob;
+            // One thread reads the block, the others wait for its outpoints
+            if (!fReady && !fReading) {
+                fRead = fReading = true;
+            } else {
+                condJob.wait(lock, [&]{ return fReady; });
+            }
+        }
+
+        if (fRead) {
+            std::shared_ptr<CBlock> pblockRead;
+            if (!fCancel) {
+                pblockRead = std::make_shared<CBlock>();
+                if (!ReadBlockFromDisk(*pblockRead, posBlock, *pconsensusParams) || pblockRead->GetHash() != hashBlock)
+                    pblockRead.reset();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            SetBlock(pblockRead, nullptr);
+            condJob.notify_all();
+        }
+
+        size_t nBegin;
+        while (!fCancel && (nBegin = nNextOutpoint.fetch_add(PREFETCH_BATCH_SIZE)) < vOutpoints.size()) {
+            const size_t nEnd = std::min(nBegin + PREFETCH_BATCH_SIZE, vOutpoints.size());
+            for (size_t i = nBegin; i < nEnd; i++) {
+                // Lookups that fail here are simply repeated by the validation thread
+                try {
+                    if (!base->GetCoin(vOutpoints[i], vCoins[i]))
+                        vCoins[i].Clear();
+                } catch (const std::exception&) {
+                    vCoins[i].Clear();
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--nActive == 0)
+            condDone.notify_one();
+    }
+}
+
+void CCoinsPrefetcher::SetBlock(const std::shared_ptr<const CBlock>& pblockIn, const CCoinsViewCache* pcacheSkip)
+{
+    pblock = pblockIn;
+    vOutpoints.clear();
+    if (pblock) {
+        // Coins created in the block itself are not in the base yet
+        std::vector<uint256> vTxids;
+        vTxids.reserve(pblock->vtx.size());
+        for (const auto& tx : pblock->vtx)
+            vTxids.push_back(tx->GetHash());
+        std::sort(vTxids.begin(), vTxids.end());
+        for (const auto& tx : pblock->vtx) {
+            if (tx->IsCoinBase())
+                continue;
+            for (const CTxIn& txin : tx->vin) {
+                if (std::binary_search(vTxids.begin(), vTxids.end(), txin.prevout.hash))
+                    continue;
+                if (pcacheSkip && pcacheSkip->HaveCoinInCache(txin.prevout))
+                    continue;
+                vOutpoints.push_back(txin.prevout);
+            }
+        }
+    }
+    vCoins.assign(vOutpoints.size(), Coin());
+    nNextOutpoint = 0;
+    fReading = false;
+    fReady = true;
+}
+
+void CCoinsPrefetcher::StartJob()
+{
+    fCancel = false;
+    nActive = vThreads.size();
+    nJob++;
+    condJob.notify_all();
+}
+
+void CCoinsPrefetcher::Wait(std::unique_lock<std::mutex>& lock)
+{
+    condDone.wait(lock, [&]{ return nActive == 0; });
+}
+
+void CCoinsPrefetcher::Clear()
+{
+    hashBlock.SetNull();
+    pblock.reset();
+    vOutpoints.clear();
+    vCoins.clear();
+    base = nullptr;
+    fReady = false;
+}
+
+void CCoinsPrefetcher::Start(const uint256& hash, const std::shared_ptr<const CBlock>& pblockIn, CCoinsView* baseIn, const CCoinsViewCache* pcacheSkip)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Wait(lock);
+    Clear();
+    hashBlock = hash;
+    base = baseIn;
+    SetBlock(pblockIn, pcacheSkip);
+    StartJob();
+}
+
+void CCoinsPrefetcher::Start(const uint256& hash, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, CCoinsView* baseIn)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Wait(lock);
+    Clear();
+    hashBlock = hash;
+    posBlock = pos;
+    pconsensusParams = &consensusParams;
+    base = baseIn;
+    StartJob();
+}
+
+std::shared_ptr<const CBlock> CCoinsPrefetcher::Finish(const uint256& hash, CCoinsViewCache& cache)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Wait(lock);
+    std::shared_ptr<const CBlock> ret;
+    if (!hash.IsNull() && hash == hashBlock && pblock) {
+        for (size_t i = 0; i < vOutpoints.size(); i++) {
+            if (!vCoins[i].IsSpent())
+                cache.CacheCoinFromBase(vOutpoints[i], std::move(vCoins[i]));
+        }
+        ret = pblock;
+    }
+    Clear();
+    return ret;
+}
+
+void CCoinsPrefetcher::Cancel()
+{
+    fCancel = true;
+    std::unique_lock<std::mutex> lock(mutex);
+    Wait(lock);
+    Clear();
+}
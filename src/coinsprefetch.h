@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "chain.h"
+#include "coins.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Consensus { struct Params; }
+
+/**
+ * Reads the coins spent by a block from a (thread safe) base view on a few
+ * threads, so that ConnectBlock finds them in the cache instead of looking
+ * them up in the database one after the other. Runs one block at a time,
+ * usually the one after the block being connected.
+ *
+ * The coins are only added to the cache by Finish(), and only where the cache
+ * has no entry, which holds the newer state. The base must not be written to
+ * between Start() and Finish(); call Cancel() before flushing the cache.
+ */
+class CCoinsPrefetcher
+{
+private:
+    std::vector<std::thread> vThreads;
+    std::mutex mutex;
+    std::condition_variable condJob;
+    std::condition_variable condDone;
+    uint64_t nJob;
+    size_t nActive;
+    bool fShutdown;
+
+    // The current job
+    uint256 hashBlock;
+    CDiskBlockPos posBlock;
+    const Consensus::Params* pconsensusParams;
+    CCoinsView* base;
+    //! Set up once the block is in memory
+    bool fReady;
+    bool fReading;
+    std::shared_ptr<const CBlock> pblock;
+    std::vector<COutPoint> vOutpoints;
+    std::vector<Coin> vCoins;
+    std::atomic<size_t> nNextOutpoint;
+    std::atomic<bool> fCancel;
+
+    void Thread();
+    void SetBlock(const std::shared_ptr<const CBlock>& pblockIn, const CCoinsViewCache* pcacheSkip);
+    void StartJob();
+    void Wait(std::unique_lock<std::mutex>& lock);
+    void Clear();
+
+public:
+    explicit CCoinsPrefetcher(int nThreads);
+    ~CCoinsPrefetcher();
+
+    /**
+     * Start reading the coins spent by pblockIn, whose hash is hash, from baseIn.
+     * Coins that pcacheSkip already holds are left out.
+     */
+    void Start(const uint256& hash, const std::shared_ptr<const CBlock>& pblockIn, CCoinsView* baseIn, const CCoinsViewCache* pcacheSkip = nullptr);
+    //! Same, reading the block itself from disk at pos first
+    void Start(const uint256& hash, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, CCoinsView* baseIn);
+
+    /**
+     * Wait for the prefetch of the block hash to finish and add the coins it
+     * found to cache, which must sit on top of the base passed to Start().
+     * Returns the block, or nullptr if it was not being prefetched.
+     */
+    std::shared_ptr<const CBlock> Finish(const uint256& hash, CCoinsViewCache& cache);
+
+    //! Stop the current prefetch and drop its results
+    void Cancel();
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
@@ -9,9 +9,9 @@
 #include <string.h>
 #include <atomic>
 
-#if defined(__x86_64__) || defined(__amd64__)
-#if defined(EXPERIMENTAL_ASM)
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
 #include <cpuid.h>
+#if defined(EXPERIMENTAL_ASM) && !defined(__i386__)
 namespace sha256_sse4
 {
 void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
@@ -19,6 +19,16 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 #endif
 #endif
 
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+
 // Internal implementation code.
 namespace
 {
@@ -141,9 +151,35 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
     }
 }
 
+/** Compute the double SHA-256 of a single 64-byte input. */
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    // Padding of a 64-byte message, and of the 32-byte first hash
+    static const unsigned char padding1[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+    unsigned char buffer2[64] = {0};
+    buffer2[32] = 0x80;
+    buffer2[62] = 1;
+
+    uint32_t s[8];
+    Initialize(s);
+    Transform(s, in, 1);
+    Transform(s, padding1, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(buffer2 + 4 * i, s[i]);
+    }
+    Initialize(s);
+    Transform(s, buffer2, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, s[i]);
+    }
+}
+
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
 
 bool SelfTest(TransformType tr) {
     static const unsigned char in1[65] = {0, 0x80};
@@ -172,23 +208,81 @@ bool SelfTest(TransformType tr) {
     return true;
 }
 
+/** Check a multi-way double SHA-256 implementation against the single one. */
+bool SelfTestD64(TransformD64Type tr, size_t ways) {
+    unsigned char in[64 * 8];
+    unsigned char out[32 * 8];
+    unsigned char expected[32];
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (unsigned char)(i * 7 + 3);
+    }
+    tr(out, in);
+    for (size_t i = 0; i < ways; i++) {
+        sha256::TransformD64(expected, in + 64 * i);
+        if (memcmp(out + 32 * i, expected, 32)) return false;
+    }
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+/** Whether the operating system saves the AVX registers on context switches. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
 TransformType Transform = sha256::Transform;
+TransformD64Type TransformD64_4way = nullptr;
+TransformD64Type TransformD64_8way = nullptr;
 
 } // namespace
 
 std::string SHA256AutoDetect()
 {
-#if defined(EXPERIMENTAL_ASM) && (defined(__x86_64__) || defined(__amd64__))
+    std::string ret = "standard";
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
     uint32_t eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
+    bool have_sse41 = false;
+    bool have_avx2 = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse41 = (ecx >> 19) & 1;
+        bool have_xsave = (ecx >> 27) & 1;
+        bool have_avx = (ecx >> 28) & 1;
+        if (have_xsave && have_avx && AVXEnabled() && __get_cpuid_max(0, nullptr) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            have_avx2 = (ebx >> 5) & 1;
+        }
+    }
+
+#if defined(EXPERIMENTAL_ASM) && !defined(__i386__)
+    if (have_sse41) {
         Transform = sha256_sse4::Transform;
-        assert(SelfTest(Transform));
-        return "sse4";
+        ret = "sse4";
+    }
+#endif
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_sse41) {
+        TransformD64_4way = sha256d64_sse41::Transform_4way;
+        assert(SelfTestD64(TransformD64_4way, 4));
+        ret += ",sse41(4way)";
     }
 #endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_avx2) {
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        assert(SelfTestD64(TransformD64_8way, 8));
+        ret += ",avx2(8way)";
+    }
+#endif
+    (void)have_sse41;
+    (void)have_avx2;
+#endif
 
     assert(SelfTest(Transform));
-    return "standard";
+    return ret;
 }
 
 ////// SHA-256
@@ -247,3 +341,29 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        sha256::TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
@@ -31,4 +31,13 @@ public:
  */
 std::string SHA256AutoDetect();
 
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ *  The output may overlap the start of the input, which makes it possible to
+ *  hash a level of a merkle tree in place.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
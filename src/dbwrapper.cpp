@@ -15,6 +15,9 @@
 #include <stdint.h>
 #include <algorithm>
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
     // This code is adapted from posix_logger.h, which is why it is using vsprintf.
@@ -73,14 +76,63 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool ParseDBProfile(const std::string& strProfile, CDBProfile& profile, std::string& strError)
+{
+    std::vector<std::string> vItems;
+    boost::split(vItems, strProfile, boost::is_any_of(","));
+    for (const std::string& strItem : vItems) {
+        size_t nSep = strItem.find('=');
+        const std::string strKey = strItem.substr(0, nSep);
+        if (nSep == std::string::npos) {
+            if (strKey == "default") {
+                profile = CDBProfile();
+            } else if (strKey == "large") {
+                profile.nMaxFileSize = 32 << 20;
+                profile.nMaxOpenFiles = 256;
+            } else {
+                strError = strprintf("unknown database profile '%s'", strKey);
+                return false;
+            }
+            continue;
+        }
+        int64_t n;
+        if (!ParseInt64(strItem.substr(nSep + 1), &n) || n < 0) {
+            strError = strprintf("invalid value for database setting '%s'", strKey);
+            return false;
+        }
+        if (strKey == "maxfilesize" && n >= 1 && n <= 1024) {
+            profile.nMaxFileSize = n << 20;
+        } else if (strKey == "maxopenfiles" && n >= 16 && n <= 65536) {
+            profile.nMaxOpenFiles = n;
+        } else if (strKey == "bloombits" && n <= 64) {
+            profile.nBloomBits = n;
+        } else if (strKey == "directread") {
+            profile.fDirectRead = n != 0;
+        } else {
+            strError = strprintf("invalid database setting '%s'", strItem);
+            return false;
+        }
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    if (profile.fDirectRead) {
+        // Only the index and filter blocks go through the cache, so leave
+        // the budget to the write buffers
+        options.block_cache = leveldb::NewLRUCache(std::min(nCacheSize / 8, (size_t)8 << 20));
+        options.write_buffer_size = nCacheSize / 2;
+    } else {
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    }
+    if (profile.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(profile.nBloomBits);
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_file_size = profile.nMaxFileSize;
+    options.max_open_files = profile.nMaxOpenFiles;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -90,14 +142,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBProfile& profile)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
+    readoptions.fill_cache = !profile.fDirectRead;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -110,6 +163,8 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
         }
         TryCreateDirectories(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrint(BCLog::LEVELDB, "LevelDB profile: maxfilesize=%u maxopenfiles=%d bloombits=%d directread=%d\n",
+            profile.nMaxFileSize, profile.nMaxOpenFiles, profile.nBloomBits, profile.fDirectRead);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
@@ -25,6 +25,29 @@ public:
     dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/** LevelDB settings that can be tuned per database */
+struct CDBProfile
+{
+    //! Size at which LevelDB starts a new table file, in bytes
+    size_t nMaxFileSize;
+    //! Number of table files LevelDB keeps open
+    int nMaxOpenFiles;
+    //! Bits per key of the bloom filter, 0 to disable it
+    int nBloomBits;
+    //! Do not cache the blocks read by point lookups; iteration never does
+    bool fDirectRead;
+
+    CDBProfile() : nMaxFileSize(2 << 20), nMaxOpenFiles(64), nBloomBits(10), fDirectRead(false) {}
+};
+
+/**
+ * Apply a comma separated list of settings to profile. Each item is either a
+ * preset ("default" or "large") or one of maxfilesize=<MiB>,
+ * maxopenfiles=<n>, bloombits=<n> and directread=<0|1>.
+ * Returns false and sets strError if the list cannot be parsed.
+ */
+bool ParseDBProfile(const std::string& strProfile, CDBProfile& profile, std::string& strError);
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -217,8 +240,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] profile     LevelDB table, file and cache settings.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBProfile& profile = CDBProfile());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -20,6 +20,12 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/** Check "user:password" against the RPC credentials: -rpcuser and
+ * -rpcpassword or the cookie, and -rpcauth.
+ * Precondition; HTTP RPC has been started.
+ */
+bool RPCCredentialsValid(const std::string& strUserPass);
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
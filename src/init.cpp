@@ -37,6 +37,7 @@
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "stratum.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -163,6 +164,7 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratumServer();
     if (g_connman)
         g_connman->Interrupt();
     threadGroup.interrupt_all();
@@ -188,6 +190,7 @@ void Shutdown()
     StopRPC();
     StopHTTPServer();
     GenerateITC (false, -1, Params());
+    StopStratumServer();
 #ifdef ENABLE_WALLET
     for (CWalletRef pwallet : vpwallets) {
         pwallet->Flush(false);
@@ -198,6 +201,7 @@ void Shutdown()
     // Because these depend on each-other, we make sure that neither can be
     // using the other before destroying them.
     UnregisterValidationInterface(peerLogic.get());
+    if (peerLogic) peerLogic->StopTxAcceptThreads();
     if(g_connman) g_connman->Stop();
     peerLogic.reset();
     g_connman.reset();
@@ -239,6 +243,7 @@ void Shutdown()
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
         }
+        StartCoinsPrefetch(0);
         delete pcoinsTip;
         pcoinsTip = nullptr;
         delete pcoinscatcher;
@@ -344,6 +349,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-backgroundflush", strprintf("Write the coin database from a background thread, in batches, keeping the cache warm on periodic writes (default: %u)", DEFAULT_BACKGROUND_FLUSH));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -360,6 +367,8 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbprofile=[<db>:]<settings>", _("Tune the LevelDB settings of the chainstate or blocks (block index and transaction index) database, or of both if <db> is omitted. "
+        "<settings> is a comma separated list of presets (default, large) and maxfilesize=<MiB>, maxopenfiles=<n>, bloombits=<n>, directread=<0|1>. Can be specified multiple times."));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
@@ -370,12 +379,15 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()));
     }
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistmempooltrusted", strprintf(_("Add back the saved mempool without checking its scripts again if the chain tip has not changed since it was saved (default: %u)"), DEFAULT_PERSIST_MEMPOOL_TRUSTED));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script and header PoW verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
+    strUsage += HelpMessageOpt("-pipelineconnect=<n>", strprintf(_("Connect up to <n> blocks at a time with the script checks of each block overlapping the next one, using a second set of -par threads (0 to disable, max: %u, default: %u)"), MAX_PIPELINE_CONNECT_BLOCKS, DEFAULT_PIPELINE_CONNECT_BLOCKS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the coins spent by the next block while the current one is connected (0 to disable, default: %d)"), DEFAULT_PREFETCH_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
@@ -384,6 +396,8 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-txacceptthreads=<n>", strprintf(_("Set the number of threads checking the scripts of the batches of transactions received from peers, without holding up block validation (0 to disable batching and accept each transaction on the message handler thread, default: %d)"), DEFAULT_TX_ACCEPT_THREADS));
+    strUsage += HelpMessageOpt("-txbatchwindow=<n>", strprintf(_("Collect transactions received from peers for up to <n> milliseconds and accept them to the mempool as one batch (default: %d)"), DEFAULT_TX_BATCH_WINDOW));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -441,6 +455,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Miner options:"));
     strUsage += HelpMessageOpt("-coinbaseaddress=<address>", _("Specify an address to use when mining"));
     strUsage += HelpMessageOpt("-rotatecoinbase", _("Refresh coinbase address when wallet mining. Has no effect if -coinbaseaddress is set"));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve work to external miners over the Stratum protocol, paying to -coinbaseaddress. Requires -server (default: %u)"), DEFAULT_STRATUM_ENABLE));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", _("Bind the Stratum server to the given address. Workers log in with the RPC credentials. Use [host]:port notation for IPv6. This option can be specified multiple times (default: 127.0.0.1)"));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty for Stratum workers, where difficulty 1 is the usual Stratum target of 0x00000000ffff0000... (default: %f)"), DEFAULT_STRATUM_DIFFICULTY));
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     strUsage += HelpMessageOpt("-uacomment=<cmt>", _("Append comment to the user agent string"));
@@ -642,18 +660,7 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
 
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        ReindexBlockFiles(chainparams);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -840,6 +847,8 @@ int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
 ServiceFlags nLocalServices = NODE_NETWORK;
+CDBProfile profileBlockTreeDB;
+CDBProfile profileCoinsDB;
 
 } // namespace
 
@@ -923,17 +932,37 @@ bool AppInitParameterInteraction()
         return InitError("Cannot set -bind or -whitebind together with -listen=0");
     }
 
+    // Database profiles
+    for (const std::string& strArg : gArgs.GetArgs("-dbprofile")) {
+        std::string strDB;
+        std::string strSettings = strArg;
+        size_t nSep = strArg.find(':');
+        if (nSep != std::string::npos) {
+            strDB = strArg.substr(0, nSep);
+            strSettings = strArg.substr(nSep + 1);
+        }
+        if (!strDB.empty() && strDB != "blocks" && strDB != "chainstate")
+            return InitError(strprintf(_("Unknown database '%s' in -dbprofile"), strDB));
+        std::string strError;
+        if ((strDB.empty() || strDB == "blocks") && !ParseDBProfile(strSettings, profileBlockTreeDB, strError))
+            return InitError(strprintf(_("Invalid -dbprofile '%s': %s"), strArg, strError));
+        if ((strDB.empty() || strDB == "chainstate") && !ParseDBProfile(strSettings, profileCoinsDB, strError))
+            return InitError(strprintf(_("Invalid -dbprofile '%s': %s"), strArg, strError));
+    }
+
     // Make sure enough file descriptors are available
+    // (MIN_CORE_FILEDESCRIPTORS covers the databases' default number of open files)
+    int nDBFiles = std::max(profileBlockTreeDB.nMaxOpenFiles - CDBProfile().nMaxOpenFiles, 0) + std::max(profileCoinsDB.nMaxOpenFiles - CDBProfile().nMaxOpenFiles, 0);
     int nBind = std::max(nUserBind, size_t(1));
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - nDBFiles - MAX_ADDNODE_CONNECTIONS)), 0);
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + nDBFiles + MAX_ADDNODE_CONNECTIONS);
+    if (nFD < MIN_CORE_FILEDESCRIPTORS + nDBFiles)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
+    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - nDBFiles - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -1036,6 +1065,8 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPipelineConnectBlocks = std::min<int64_t>(std::max<int64_t>(gArgs.GetArg("-pipelineconnect", DEFAULT_PIPELINE_CONNECT_BLOCKS), 0), MAX_PIPELINE_CONNECT_BLOCKS);
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1250,12 +1281,24 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     InitSignatureCache();
     InitScriptExecutionCache();
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script, header PoW and reindex block verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPoWCheck);
+            threadGroup.create_thread(&ThreadImportCheck);
+        }
+        if (nPipelineConnectBlocks > 1) {
+            LogPrintf("Connecting up to %u blocks at a time with overlapping script checks\n", nPipelineConnectBlocks);
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadScriptCheckPipelined);
+        }
     }
 
+    int nPrefetchThreads = std::min<int>(gArgs.GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS);
+    LogPrintf("Using %d threads to prefetch block inputs\n", std::max(nPrefetchThreads, 0));
+    StartCoinsPrefetch(nPrefetchThreads);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1432,7 +1475,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReset);
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReset, profileBlockTreeDB);
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1483,7 +1526,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 // At this point we're either in reindex or we've loaded a useful
                 // block tree into mapBlockIndex!
 
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState, profileCoinsDB);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
 
                 // If necessary, upgrade from older database format.
@@ -1724,6 +1767,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    if (gArgs.GetBoolArg("-stratum", DEFAULT_STRATUM_ENABLE) && !StartStratumServer()) {
+        return false;
+    }
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -164,6 +165,14 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename P, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // The nodes live in the pool's chunks, whether in use or on its free lists
+    const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* resource = m.get_allocator().GetResource();
+    return MallocUsage(resource->ChunkSizeBytes()) * resource->NumChunks() + MallocUsage(sizeof(char*) * resource->NumChunks()) + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -5,6 +5,11 @@
 
 #if ! defined __MINGW32__
  #include <sys/resource.h>
+ #include <sys/mman.h>
+#endif
+#ifdef __linux__
+ #include <pthread.h>
+ #include <sched.h>
 #endif
 
 #include "miner.h"
@@ -18,6 +23,7 @@
 #include "consensus/tx_verify.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "validation.h"
 #include "net.h"
@@ -26,15 +32,22 @@
 #include "pow.h"
 #include "primitives/transaction.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 #include "wallet/wallet.h"
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <limits>
+#include <map>
 #include <queue>
+#include <set>
 #include <utility>
 
 //////////////////////////////////////////////////////////////////////////////
@@ -140,7 +153,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    LOCK2(cs_main, mempool.cs);
+    LOCK(cs_main);
     CBlockIndex* pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
@@ -167,24 +180,19 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    {
+        // The pool is only needed to select the transactions, so readers of
+        // the pool can go on while the block is checked below
+        LOCK(mempool.cs);
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
     nLastBlockTx = nBlockTx;
     nLastBlockWeight = nBlockWeight;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    CreateCoinbase(pindexPrev, scriptPubKeyIn);
 
     LogPrintf("CreateNewBlock(): block weight: %u txs: %u fees: %ld sigops %d\n", GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
     
@@ -193,7 +201,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
@@ -206,6 +213,238 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+std::unique_ptr<CBlockTemplate> BlockAssembler::UpdateNewBlock(const CBlockTemplate& blocktemplate, const std::vector<uint256>& vAdded)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    resetBlock();
+
+    pblocktemplate.reset(new CBlockTemplate(blocktemplate));
+    pblock = &pblocktemplate->block;
+
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pblock->hashPrevBlock != pindexPrev->GetBlockHash())
+        return nullptr;
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblock->GetBlockTime();
+    fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+
+    int nPackagesSelected = 0;
+    {
+        // As in CreateNewBlock, the pool is only needed for the selection
+        LOCK(mempool.cs);
+        if (!addNewPackageTxs(vAdded, nPackagesSelected))
+            return nullptr;
+    }
+
+    int64_t nTime1 = GetTimeMicros();
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockWeight = nBlockWeight;
+
+    CreateCoinbase(pindexPrev, blocktemplate.block.vtx[0]->vout[0].scriptPubKey);
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+
+    // The coinbase, time, nBits and transactions all changed, so the block
+    // is checked like a new one; if it fails, it is assembled from scratch
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        LogPrintf("%s: TestBlockValidity failed: %s\n", __func__, FormatStateMessage(state));
+        return nullptr;
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint(BCLog::BENCH, "UpdateNewBlock() %d new packages, %u txs: %.2fms, validity: %.2fms (total %.2fms)\n", nPackagesSelected, nBlockTx, 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    return std::move(pblocktemplate);
+}
+
+bool BlockAssembler::addNewPackageTxs(const std::vector<uint256>& vAdded, int &nPackagesSelected)
+{
+    // Restore the state of the block from the transactions already in it
+    for (size_t i = 1; i < pblock->vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(pblock->vtx[i]->GetHash());
+        if (it == mempool.mapTx.end())
+            return false;
+        nBlockWeight += it->GetTxWeight();
+        ++nBlockTx;
+        nBlockSigOpsCost += it->GetSigOpCost();
+        nFees += it->GetFee();
+        inBlock.insert(it);
+    }
+
+    // Take the new transactions by ancestor score, the order addPackageTxs
+    // would have seen them in, and add each with its unconfirmed ancestors.
+    std::vector<CTxMemPool::txiter> vNew;
+    for (const uint256& hash : vAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end() && !inBlock.count(it))
+            vNew.push_back(it);
+    }
+    std::sort(vNew.begin(), vNew.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    });
+
+    for (CTxMemPool::txiter iter : vNew) {
+        if (inBlock.count(iter))
+            continue; // already added as an ancestor of another new transaction
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        for (CTxMemPool::txiter it : ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOpsCost += it->GetSigOpCost();
+        }
+
+        if (packageFees < blockMinFeeRate.GetFee(packageSize))
+            continue;
+
+        // A full selection could make room by leaving out cheaper packages
+        if (!TestPackage(packageSize, packageSigOpsCost))
+            return false;
+
+        if (!TestPackageTransactions(ancestors))
+            continue;
+
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
+        for (CTxMemPool::txiter it : sortedEntries)
+            AddToBlock(it);
+        ++nPackagesSelected;
+    }
+    return true;
+}
+
+void BlockAssembler::CreateCoinbase(const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn)
+{
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    pblocktemplate->vTxFees[0] = -nFees;
+    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
+}
+
+CBlockTemplateCache::CBlockTemplateCache() : fStale(false), nStaleCount(0), nTemplateCount(0), nBuilding(0)
+{
+}
+
+/** Beyond this many queued transactions a full rebuild is cheaper than updating the template */
+static const size_t MAX_TEMPLATE_UPDATE_TXS = 10000;
+
+void CBlockTemplateCache::MarkStale()
+{
+    AssertLockHeld(cs);
+    fStale = true;
+    ++nStaleCount;
+    vAdded.clear();
+}
+
+void CBlockTemplateCache::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(cs);
+    // While a template is built, it may or may not see this transaction
+    if ((!pblocktemplate || fStale) && nBuilding == 0)
+        return;
+    vAdded.push_back(tx->GetHash());
+    if (vAdded.size() > MAX_TEMPLATE_UPDATE_TXS)
+        MarkStale();
+}
+
+void CBlockTemplateCache::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    // Removals for a block come with a new tip, which forces a rebuild anyway.
+    // A template being built may still have seen the transaction.
+    if (reason != MemPoolRemovalReason::BLOCK && (nBuilding > 0 || setTemplateTx.count(tx->GetHash())))
+        MarkStale();
+}
+
+void CBlockTemplateCache::Invalidate()
+{
+    LOCK(cs);
+    MarkStale();
+}
+
+std::unique_ptr<CBlockTemplate> CBlockTemplateCache::Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    // The mempool notifies the cache with its lock held, so cs is not held
+    // while the template is built; BlockAssembler takes the locks it needs.
+    std::unique_ptr<CBlockTemplate> pbase;
+    std::vector<uint256> vAddedBase;
+    uint64_t nStaleCountStart;
+    uint64_t nTemplateCountStart;
+    {
+        LOCK(cs);
+        if (!connAdded.connected()) {
+            connAdded = mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateCache::TransactionAdded, this, _1));
+            connRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateCache::TransactionRemoved, this, _1, _2));
+        }
+        if (pblocktemplate && !fStale) {
+            pbase.reset(new CBlockTemplate(*pblocktemplate));
+            vAddedBase = vAdded;
+        }
+        nStaleCountStart = nStaleCount;
+        nTemplateCountStart = nTemplateCount;
+        ++nBuilding;
+    }
+
+    std::unique_ptr<CBlockTemplate> pnewtemplate;
+    try {
+        BlockAssembler assembler(chainparams);
+        if (pbase)
+            pnewtemplate = assembler.UpdateNewBlock(*pbase, vAddedBase);
+        if (!pnewtemplate)
+            pnewtemplate = assembler.CreateNewBlock(CScript());
+    } catch (...) {
+        LOCK(cs);
+        --nBuilding;
+        throw;
+    }
+
+    std::unique_ptr<CBlockTemplate> pcopy(new CBlockTemplate(*pnewtemplate));
+    CMutableTransaction coinbaseTx(*pcopy->block.vtx[0]);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    pcopy->block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+
+    LOCK(cs);
+    --nBuilding;
+    // Unless another caller stored a template meanwhile, keep this one, along
+    // with the transactions added since it was started on
+    if (nTemplateCount == nTemplateCountStart) {
+        pblocktemplate = std::move(pnewtemplate);
+        ++nTemplateCount;
+        setTemplateTx.clear();
+        for (const CTransactionRef& tx : pblocktemplate->block.vtx)
+            setTemplateTx.insert(tx->GetHash());
+        if (nStaleCount == nStaleCountStart) {
+            fStale = false;
+            vAdded.erase(vAdded.begin(), vAdded.begin() + std::min(vAdded.size(), vAddedBase.size()));
+        }
+    }
+    return pcopy;
+}
+
+CBlockTemplateCache blockTemplateCache;
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -458,8 +697,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
 
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
 {
-    BlockAssembler assembler (chainparams);
-    return assembler.CreateNewBlock(scriptPubKeyIn).release();
+    return blockTemplateCache.Get(chainparams, scriptPubKeyIn).release();
 }
 
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
@@ -491,12 +729,12 @@ struct MinerInfo {
     MinerInfo()
     { 
         nHashes = 0;
-        nNonceOffset = 0;
+        nCpu = -1;
         fKill = 0;
     }
 
     std::atomic<int64_t> nHashes;
-    std::atomic<int> nNonceOffset;
+    std::atomic<int> nCpu; // CPU the thread is pinned to, -1 if none
     std::atomic<int> fKill;
 };
 
@@ -504,6 +742,46 @@ static std::atomic<int> fMinerRunning; // <= 0 if not running
 static std::atomic<int64_t> nMinerStartTime; // millis
 static std::vector<MinerInfo*> vMiners; // one for each thread
 
+/**
+ * Miner threads claim nonces in chunks of MINER_NONCE_CHUNK from this shared
+ * cursor instead of owning a fixed slice of the nonce space. A thread that
+ * rebuilds its block or is descheduled simply claims less, and no two threads
+ * ever hash the same nonce, even when their templates are identical.
+ */
+static const uint32_t MINER_NONCE_CHUNK = 0x1000;
+static std::atomic<uint32_t> nMinerNonceCursor;
+
+static uint32_t ClaimNonceChunk()
+{
+    return nMinerNonceCursor.fetch_add(MINER_NONCE_CHUNK);
+}
+
+/**
+ * Tells the miner threads when their work goes stale. Each counter is bumped by
+ * the validation signals and compared by the miners with the value they saw
+ * when building their block, so a new tip is noticed within one hash.
+ */
+class CMinerWorkNotifier : public CValidationInterface
+{
+public:
+    std::atomic<uint64_t> nTipGeneration{0};
+    std::atomic<uint64_t> nMempoolGeneration{0};
+    bool fRegistered = false;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override
+    {
+        nTipGeneration++;
+    }
+
+    void TransactionAddedToMempool(const CTransactionRef &ptxn) override
+    {
+        nMempoolGeneration++;
+    }
+};
+
+static CMinerWorkNotifier minerWorkNotifier;
+
 #if ! defined (__MINGW32__)
  #ifndef PRIO_MAX
   #define PRIO_MAX 20
@@ -514,6 +792,85 @@ static std::vector<MinerInfo*> vMiners; // one for each thread
  #define THREAD_PRIORITY_ABOVE_NORMAL    (-2)
 #endif
 
+#ifdef __linux__
+static std::string ReadSysfsLine(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+/** CPUs sharing the cache of the given level with nCpu, as a sysfs CPU list */
+static std::string GetCacheSharing(int nCpu, int nLevel)
+{
+    const std::string dir = strprintf("/sys/devices/system/cpu/cpu%d/cache/", nCpu);
+    for (int nIndex = 0; ; nIndex++) {
+        const std::string index = strprintf("%sindex%d/", dir, nIndex);
+        const std::string level = ReadSysfsLine(index + "level");
+        if (level.empty())
+            return "";
+        if (level == std::to_string(nLevel) && ReadSysfsLine(index + "type") != "Instruction")
+            return ReadSysfsLine(index + "shared_cpu_list");
+    }
+}
+#endif
+
+/**
+ * Choose the CPUs to run miner threads on. Every yespower sandbox is far larger
+ * than an L2 cache, so two threads sharing an L2 (SMT siblings) mostly fight over
+ * it; we take one CPU per L2 domain. The CPUs are ordered round-robin over the
+ * L3 domains, which usually also means over NUMA nodes, so that a smaller thread
+ * count still spreads the sandboxes over all last-level caches and memory
+ * controllers. Returns an empty vector if the topology is unknown.
+ */
+static std::vector<int> GetMinerCpus()
+{
+    std::vector<int> vCpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return vCpus;
+
+    std::set<std::string> setL2Seen;
+    std::map<std::string, std::vector<int>> mapL3Domains;
+    for (int nCpu = 0; nCpu < CPU_SETSIZE; nCpu++) {
+        if (!CPU_ISSET(nCpu, &allowed))
+            continue;
+        std::string l2 = GetCacheSharing(nCpu, 2);
+        if (l2.empty())
+            l2 = ReadSysfsLine(strprintf("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", nCpu));
+        if (l2.empty())
+            l2 = std::to_string(nCpu);
+        if (!setL2Seen.insert(l2).second)
+            continue;
+        mapL3Domains[GetCacheSharing(nCpu, 3)].push_back(nCpu);
+    }
+
+    for (size_t i = 0; vCpus.size() < setL2Seen.size(); i++) {
+        for (const auto& domain : mapL3Domains) {
+            if (i < domain.second.size())
+                vCpus.push_back(domain.second[i]);
+        }
+    }
+#endif
+    return vCpus;
+}
+
+/** Pin the calling thread to a single CPU */
+static bool PinThreadToCpu(int nCpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(nCpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
 static void SetThreadPriority (int nPriority)
 {
    #ifdef WIN32
@@ -550,30 +907,167 @@ double EstimateMinerHashesPerSecond()
     return 1000.0 * ((double)nMinerTotalHashes / nDeltaTime);
 }
 
+/** Size of the yespower sandbox for our parameters, laid out as in yespower() */
+static size_t YespowerSandboxSize()
+{
+    const size_t B_size = (size_t)128 * yespower_1_0_faircoin.r;
+    const size_t V_size = B_size * yespower_1_0_faircoin.N;
+    const size_t XY_size = B_size + 64;
+    const size_t S_size = 3 * ((size_t)1 << 11) * 2 * 8; // three pwxform S-boxes, Swidth 11
+    return B_size + V_size + XY_size + S_size;
+}
+
+/**
+ * Preallocate the yespower sandbox of a scanner. The yespower library only asks
+ * for huge pages above 12 MiB, which our sandbox never reaches, so every random
+ * access into it would otherwise risk a TLB miss. Try reserved huge pages first
+ * and fall back to a 2 MiB aligned mapping eligible for transparent huge pages.
+ * The region is released by yespower_free_local(), which munmap()s it.
+ */
+static void AllocYespowerSandbox(yespower_local_t& local)
+{
+#if defined(MAP_ANONYMOUS) && defined(MAP_HUGETLB)
+    const size_t nHugePage = 2 * 1024 * 1024;
+    const size_t nSize = YespowerSandboxSize();
+    size_t nMapSize = (nSize + nHugePage - 1) & ~(nHugePage - 1);
+    uint8_t* base = (uint8_t*)mmap(nullptr, nMapSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    uint8_t* aligned = base;
+    if (base == MAP_FAILED) {
+        nMapSize += nHugePage;
+        base = (uint8_t*)mmap(nullptr, nMapSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (base == MAP_FAILED)
+            return; // yespower() will allocate a region on first use
+        aligned = base + ((nHugePage - ((uintptr_t)base & (nHugePage - 1))) & (nHugePage - 1));
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, nMapSize - (aligned - base), MADV_HUGEPAGE);
+#endif
+    }
+    local.base = base;
+    local.aligned = aligned;
+    local.base_size = nMapSize;
+    local.aligned_size = nSize;
+#endif
+}
+
+CYespowerScanner::CYespowerScanner()
+{
+    memset(vchHeader, 0, sizeof(vchHeader));
+    yespower_init_local(&local);
+    AllocYespowerSandbox(local);
+}
+
+CYespowerScanner::~CYespowerScanner()
+{
+    yespower_free_local(&local);
+}
+
+void CYespowerScanner::SetHeader(const CBlockHeader& header)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    assert(ss.size() == sizeof(vchHeader));
+    memcpy(vchHeader, ss.data(), sizeof(vchHeader));
+}
+
+void CYespowerScanner::Hash(uint32_t nNonce, uint256& hash)
+{
+    // nNonce is the last field of the serialized header
+    WriteLE32(&vchHeader[BLOCK_HEADER_SIZE - 4], nNonce);
+    if (yespower(&local, vchHeader, sizeof(vchHeader), &yespower_1_0_faircoin, (yespower_binary_t *)hash.begin()))
+        abort();
+}
+
+CHeaderSolver::CHeaderSolver(int nThreads) : nJob(0), nActive(0), fShutdown(false)
+{
+    for (int i = 0; i < std::max(1, nThreads); i++)
+        vThreads.emplace_back(&CHeaderSolver::Thread, this);
+}
+
+CHeaderSolver::~CHeaderSolver()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fShutdown = true;
+    }
+    condJob.notify_all();
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
+
+void CHeaderSolver::Thread()
+{
+    RenameThread("faircoin-solver");
+    CYespowerScanner scanner;
+    uint64_t nLastJob = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condJob.wait(lock, [&]{ return fShutdown || nJob != nLastJob; });
+            if (fShutdown)
+                return;
+            nLastJob = nJob;
+            scanner.SetHeader(header);
+        }
+
+        // Claim nonces in order and give up on those above a solution found
+        // by another thread, so the lowest solution wins, as in a serial loop.
+        uint256 hash;
+        uint64_t nClaimed;
+        while ((nClaimed = nNextNonce++) < nFound.load()) {
+            const uint32_t nNonce = nClaimed;
+            scanner.Hash(nNonce, hash);
+            if (CheckProofOfWork(hash, header.nBits, *pconsensusParams)) {
+                uint32_t nPrev = nFound.load();
+                while (nNonce < nPrev && !nFound.compare_exchange_weak(nPrev, nNonce));
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--nActive == 0)
+            condDone.notify_one();
+    }
+}
+
+bool CHeaderSolver::Solve(CBlockHeader& headerIn, uint32_t nNonceEnd, const Consensus::Params& consensusParams)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    header = headerIn;
+    pconsensusParams = &consensusParams;
+    nNextNonce = headerIn.nNonce;
+    nFound = std::max(headerIn.nNonce, nNonceEnd);
+    nActive = vThreads.size();
+    nJob++;
+    condJob.notify_all();
+    condDone.wait(lock, [&]{ return nActive == 0; });
+
+    headerIn.nNonce = nFound;
+    return nFound < nNonceEnd;
+}
+
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
-// The nonce is usually preserved between calls, but periodically or if the
-// nonce is 0xffff0000 or above, the block is rebuilt and nNonce starts over at
-// zero.
+// The nonce is usually preserved between calls. It returns false at the end of
+// every nonce chunk, after which the caller claims a new one, and if the chunk
+// starts at 0xffff0000 or above the block is rebuilt. It also returns false as
+// soon as the tip moves away from nTipGeneration. nNonce is the last nonce
+// tried. The scanner must have been given the current header.
 //
-bool static ScanHash (MinerInfo* miner, const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
+bool static ScanHash (MinerInfo* miner, CYespowerScanner& scanner, uint64_t nTipGeneration, uint32_t& nNonce, uint256 *phash)
 {
-    assert(miner != nullptr && pblock != nullptr && phash != nullptr);
-    CBlockHeader& block = *const_cast<CBlockHeader*> (pblock);
-    const auto start = GetTimeMillis();
+    assert(miner != nullptr && phash != nullptr);
 
     while (true)
     {   
         nNonce++;
-        block.nNonce = nNonce;
-        *phash = block.GetHashYespower();
+        scanner.Hash(nNonce, *phash);
         miner->nHashes += 1;
 
         if (((uint16_t*)phash)[15] <= 32)
             return true;
 
         // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xfff) == 0 || miner->fKill > 0) {
+        if ((nNonce & (MINER_NONCE_CHUNK - 1)) == MINER_NONCE_CHUNK - 1 || miner->fKill > 0
+            || minerWorkNotifier.nTipGeneration != nTipGeneration) {
             if (miner->fKill > 0)
                 LogPrintf("FairCoin miner kill flag > 0\n");
             return false;
@@ -614,7 +1108,13 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
     SetThreadPriority (THREAD_PRIORITY_LOWEST);
     RenameThread ("faircoin-miner");
 
+    // Pin before the sandbox is allocated, so that its pages are first touched,
+    // and therefore placed, on the NUMA node of our CPU.
+    if (miner->nCpu >= 0 && !PinThreadToCpu(miner->nCpu))
+        LogPrintf("FairCoin Miner: could not pin thread to CPU %d\n", (int) miner->nCpu);
+
     unsigned int nExtraNonce = 0;
+    CYespowerScanner scanner;
 
     std::shared_ptr<CReserveScript> coinbaseScript;
     const std::string miningAddrStr = gArgs.GetArg ("-coinbaseaddress", "");
@@ -659,7 +1159,9 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
             //
             // Create new block
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+            // Read before the block is built, so a change while building makes it stale
+            const uint64_t nTipGeneration = minerWorkNotifier.nTipGeneration;
+            const uint64_t nMempoolGenerationLast = minerWorkNotifier.nMempoolGeneration;
             CBlockIndex* pindexPrev = chainActive.Tip();
             std::auto_ptr<CBlockTemplate> pblocktemplate;
 
@@ -688,13 +1190,15 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
             int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
             uint256 hash;
-            uint32_t nNonce = static_cast<uint32_t> ((int) miner->nNonceOffset);
+            uint32_t nNonceChunk = ClaimNonceChunk();
+            uint32_t nNonce = nNonceChunk - 1; // ScanHash increments before hashing
             bool fBlockFound = false;
+            scanner.SetHeader(*pblock);
 
             while (true) {
                 // Check if something found
                 
-                if (ScanHash (miner, pblock, nNonce, &hash))
+                if (ScanHash (miner, scanner, nTipGeneration, nNonce, &hash))
                 {
                     if (UintToArith256(hash) <= hashTarget)
                     {
@@ -725,12 +1229,19 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
                 const bool fvNodesEmpty = g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL) <= 0;
                 if (fvNodesEmpty && chainparams.MiningRequiresPeers())
                     break;
-                if (nNonce >= 0xffff0000)
+                if (nNonce == nNonceChunk + MINER_NONCE_CHUNK - 1) {
+                    nNonceChunk = ClaimNonceChunk();
+                    nNonce = nNonceChunk - 1;
+                }
+                if (nNonceChunk >= 0xffff0000)
                     break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                if (minerWorkNotifier.nTipGeneration != nTipGeneration)
                     break;
+                // In case the notifier is not registered or missed the signal
                 if (pindexPrev != chainActive.Tip())
                     break;
+                if (minerWorkNotifier.nMempoolGeneration != nMempoolGenerationLast && GetTime() - nStart > 60)
+                    break;
 
                 // Update nTime every few seconds
                 if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
@@ -741,6 +1252,7 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
                     // Changing pblock->nTime can change work required on testnet:
                     hashTarget.SetCompact(pblock->nBits);
                 }
+                scanner.SetHeader(*pblock);
             }
         }
     }
@@ -759,9 +1271,10 @@ void static ITCMiner(MinerInfo* miner, const CChainParams& chainparams)
 void GenerateITC(bool fGenerate, int nThreads, const CChainParams& chainparams)
 {
     static boost::thread_group* minerThreads = nullptr;
-    
+
+    const std::vector<int> vCpus = GetMinerCpus();
     if (nThreads < 0)
-        nThreads = GetNumCores();
+        nThreads = vCpus.empty() ? GetNumCores() : vCpus.size();
 
     if (minerThreads != nullptr)
     {
@@ -775,16 +1288,29 @@ void GenerateITC(bool fGenerate, int nThreads, const CChainParams& chainparams)
 
     MinerResetStats();
 
-    if (nThreads <= 0 || !fGenerate)
+    if (nThreads <= 0 || !fGenerate) {
+        if (minerWorkNotifier.fRegistered) {
+            UnregisterValidationInterface(&minerWorkNotifier);
+            minerWorkNotifier.fRegistered = false;
+        }
         return;
+    }
+
+    if (!minerWorkNotifier.fRegistered) {
+        RegisterValidationInterface(&minerWorkNotifier);
+        minerWorkNotifier.fRegistered = true;
+    }
 
-    const int nNonceMultiplier = 0xffff0000 / nThreads;
+    // Only pin when every thread can have a core of its own
+    const bool fPin = nThreads <= (int)vCpus.size();
     for (int i = 0; i < nThreads; i++)
     {
         auto* const miner = new MinerInfo();
-        miner->nNonceOffset = i * nNonceMultiplier;
+        if (fPin)
+            miner->nCpu = vCpus[i];
         vMiners.push_back (miner);
     }
+    LogPrintf("FairCoin Miner: starting %d threads%s\n", nThreads, fPin ? " pinned to separate cores" : "");
 
     nMinerStartTime = GetTimeMillis();
     minerThreads = new boost::thread_group();
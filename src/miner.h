@@ -7,10 +7,18 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <boost/signals2/connection.hpp>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
@@ -170,6 +178,15 @@ public:
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Extend blocktemplate, built on the current tip, with the packages of
+      * the given new mempool transactions. Returns nullptr if the template
+      * has to be rebuilt with CreateNewBlock instead, also when the result
+      * fails TestBlockValidity. The new packages are added after the ones
+      * already in the template. While they all fit, those are the
+      * transactions a full selection would pick, in a different order; once
+      * one doesn't fit nullptr is returned, as a full selection could leave
+      * out cheaper packages to make room for it. */
+    std::unique_ptr<CBlockTemplate> UpdateNewBlock(const CBlockTemplate& blocktemplate, const std::vector<uint256>& vAdded);
 
 private:
     // utility functions
@@ -177,12 +194,18 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Create the coinbase paying the collected fees and subsidy to scriptPubKeyIn */
+    void CreateCoinbase(const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
+    /** Restore the block's state from the transactions already in pblock and
+      * add the packages of the given new mempool transactions after them.
+      * Returns false if the block has to be assembled from scratch instead. */
+    bool addNewPackageTxs(const std::vector<uint256>& vAdded, int &nPackagesSelected);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -205,6 +228,106 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Block template kept up to date with the mempool. Transactions entering the
+ * mempool are queued and only their packages are added to the cached template
+ * on the next Get(); a new tip, the removal of a template transaction or a
+ * package that no longer fits makes it rebuild the template from scratch.
+ */
+class CBlockTemplateCache
+{
+private:
+    CCriticalSection cs;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    std::set<uint256> setTemplateTx;
+    std::vector<uint256> vAdded;
+    bool fStale;
+    //! Counts how often the template became stale and was replaced, to tell
+    //! whether either happened while Get() built a template without cs held
+    uint64_t nStaleCount;
+    uint64_t nTemplateCount;
+    //! Number of Get() calls building a template
+    int nBuilding;
+
+    void MarkStale();
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+public:
+    CBlockTemplateCache();
+
+    /** Return a template on the current tip with coinbase to scriptPubKeyIn */
+    std::unique_ptr<CBlockTemplate> Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+    /** Force a full rebuild on the next Get(), e.g. after fee deltas changed */
+    void Invalidate();
+};
+
+extern CBlockTemplateCache blockTemplateCache;
+
+/**
+ * Allocation-free yespower hashing of one block header over many nonces.
+ * The header is serialized once into a fixed buffer and only the nonce bytes
+ * are patched for every hash. The yespower sandbox is allocated once, backed
+ * by huge pages where the OS allows it, and reused for every hash.
+ * An instance must only be used by one thread at a time.
+ */
+class CYespowerScanner
+{
+private:
+    unsigned char vchHeader[BLOCK_HEADER_SIZE];
+    yespower_local_t local;
+
+public:
+    CYespowerScanner();
+    ~CYespowerScanner();
+    CYespowerScanner(const CYespowerScanner&) = delete;
+    CYespowerScanner& operator=(const CYespowerScanner&) = delete;
+
+    /** Set the header to be hashed. Its nNonce is replaced on every Hash() call. */
+    void SetHeader(const CBlockHeader& header);
+    /** Compute the yespower hash of the current header with the given nonce */
+    void Hash(uint32_t nNonce, uint256& hash);
+};
+
+/**
+ * Pool of threads that search the nonces of a block header for one meeting
+ * its nBits, each hashing with its own CYespowerScanner.
+ */
+class CHeaderSolver
+{
+private:
+    std::vector<std::thread> vThreads;
+    std::mutex mutex;
+    std::condition_variable condJob;
+    std::condition_variable condDone;
+    uint64_t nJob;
+    size_t nActive;
+    bool fShutdown;
+
+    // The current job
+    CBlockHeader header;
+    const Consensus::Params* pconsensusParams;
+    std::atomic<uint64_t> nNextNonce;
+    std::atomic<uint32_t> nFound;
+
+    void Thread();
+
+public:
+    explicit CHeaderSolver(int nThreads);
+    ~CHeaderSolver();
+
+    /**
+     * Find the lowest nonce from header.nNonce up to (not including) nNonceEnd
+     * that meets header.nBits and store it in header.nNonce. Returns false,
+     * with header.nNonce set to nNonceEnd, if there is none.
+     * Only one Solve() may run at a time.
+     */
+    bool Solve(CBlockHeader& header, uint32_t nNonceEnd, const Consensus::Params& consensusParams);
+};
+
 /** Run the miner threads */
 void GenerateITC(bool fGenerate, int nThreads, const CChainParams& chainparams);
 /** Generate a new block, without valid proof-of-work */
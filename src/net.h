@@ -830,6 +830,16 @@ public:
         }
     }
 
+    void PushTxInventory(const std::vector<uint256>& vHash)
+    {
+        LOCK(cs_inventory);
+        for (const uint256& hash : vHash) {
+            if (!filterInventoryKnown.contains(hash)) {
+                setInventoryTxToSend.insert(hash);
+            }
+        }
+    }
+
     void PushBlockHash(const uint256 &hash)
     {
         LOCK(cs_inventory);
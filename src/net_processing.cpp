@@ -25,6 +25,7 @@
 #include "reverse_iterator.h"
 #include "scheduler.h"
 #include "tinyformat.h"
+#include "txacceptqueue.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -128,6 +129,14 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Threads checking the scripts of the batches of txBatchQueue. */
+    std::unique_ptr<CTxAcceptQueue> txAcceptQueue;
+    /** Transactions received from peers, waiting to be accepted to the mempool as a batch, if enabled. */
+    typedef std::pair<CNode*, CTransactionRef> QueuedTx;
+    std::unique_ptr<CTxBatchQueue<QueuedTx> > txBatchQueue;
+    /** Transactions queued on txBatchQueue or being accepted from it. Protected by cs_main. */
+    std::set<uint256> setTxAccepting;
 } // namespace
 
 namespace {
@@ -167,6 +176,8 @@ struct CNodeState {
     const CBlockIndex *pindexBestHeaderSent;
     //! Length of current-streak of unconnecting headers announcements
     int nUnconnectingHeaders;
+    //! Number of headers from this peer we hash before any of them is accepted, see ProcessNewBlockHeaders.
+    unsigned int nHeadersPoWBudget;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
     //! When to potentially disconnect peer for stalling headers download
@@ -239,6 +250,7 @@ struct CNodeState {
         pindexLastCommonBlock = nullptr;
         pindexBestHeaderSent = nullptr;
         nUnconnectingHeaders = 0;
+        nHeadersPoWBudget = 1;
         fSyncStarted = false;
         nHeadersSyncTimeout = 0;
         nStallingSince = 0;
@@ -768,6 +780,8 @@ void Misbehaving(NodeId pnode, int howmuch)
 
 
 //////////////////////////////////////////////////////////////////////////////
+static void AcceptTransactionBatch(std::vector<QueuedTx>& vBatch, CConnman* connman);
+
 //
 // blockchain -> download logic notification
 //
@@ -775,6 +789,13 @@ void Misbehaving(NodeId pnode, int howmuch)
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &scheduler) : connman(connmanIn), m_stale_tip_check_time(0) {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    int nTxAcceptThreads = std::min<int>(gArgs.GetArg("-txacceptthreads", DEFAULT_TX_ACCEPT_THREADS), MAX_TX_ACCEPT_THREADS);
+    if (nTxAcceptThreads > 0) {
+        txAcceptQueue.reset(new CTxAcceptQueue(nTxAcceptThreads, MAX_TX_BATCH_SIZE));
+        txBatchQueue.reset(new CTxBatchQueue<QueuedTx>(std::bind(&AcceptTransactionBatch, std::placeholders::_1, connmanIn),
+                                                       std::max<int64_t>(0, gArgs.GetArg("-txbatchwindow", DEFAULT_TX_BATCH_WINDOW)),
+                                                       MAX_TX_BATCH_SIZE, MAX_TX_ACCEPT_QUEUE));
+    }
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     // Stale tip checking and peer eviction are on two different timers, but we
@@ -785,6 +806,18 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &schedu
     scheduler.scheduleEvery(std::bind(&PeerLogicValidation::CheckForStaleTipAndEvictPeers, this, consensusParams), EXTRA_PEER_CHECK_INTERVAL * 1000);
 }
 
+PeerLogicValidation::~PeerLogicValidation() {
+    txBatchQueue.reset();
+    txAcceptQueue.reset();
+}
+
+void PeerLogicValidation::StopTxAcceptThreads() {
+    if (txBatchQueue)
+        txBatchQueue->Stop();
+    if (txAcceptQueue)
+        txAcceptQueue->Stop();
+}
+
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) {
     LOCK(cs_main);
 
@@ -955,6 +988,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
+                   setTxAccepting.count(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
                    pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
                    pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
@@ -967,12 +1001,13 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
-static void RelayTransaction(const CTransaction& tx, CConnman* connman)
+static void RelayTransactions(const std::vector<uint256>& vHash, CConnman* connman)
 {
-    CInv inv(MSG_TX, tx.GetHash());
-    connman->ForEachNode([&inv](CNode* pnode)
+    if (vHash.empty())
+        return;
+    connman->ForEachNode([&vHash](CNode* pnode)
     {
-        pnode->PushInventory(inv);
+        pnode->PushTxInventory(vHash);
     });
 }
 
@@ -1087,8 +1122,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     std::shared_ptr<const CBlock> pblock;
+                    CSerializedNetMsg msgRawBlock;
                     if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
                         pblock = a_recent_block;
+                    } else if (inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_BLOCK && !IsWitnessEnabled(mi->second->pprev, consensusParams))) {
+                        // Send block from disk as it is stored, which is its wire format
+                        // with witnesses; blocks from before segwit activated have none
+                        if (!ReadRawBlockFromDisk(msgRawBlock.data, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        msgRawBlock.command = NetMsgType::BLOCK;
                     } else {
                         // Send block from disk
                         std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
@@ -1096,7 +1138,9 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                             assert(!"cannot load block from disk");
                         pblock = pblockRead;
                     }
-                    if (inv.type == MSG_BLOCK)
+                    if (!pblock)
+                        connman->PushMessage(pfrom, std::move(msgRawBlock));
+                    else if (inv.type == MSG_BLOCK)
                         connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
@@ -1241,9 +1285,11 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
 
     bool received_new_header = false;
     const CBlockIndex *pindexLast = nullptr;
+    unsigned int nPoWBudget;
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom->GetId());
+        nPoWBudget = nodestate->nHeadersPoWBudget;
 
         // If this looks like it could be a block announcement (nCount <
         // MAX_BLOCKS_TO_ANNOUNCE), use special logic for handling headers that
@@ -1290,7 +1336,12 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
 
     CValidationState state;
     CBlockHeader first_invalid_header;
-    if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header)) {
+    bool fAccepted = ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header, &nPoWBudget);
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->nHeadersPoWBudget = nPoWBudget;
+    }
+    if (!fAccepted) {
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             LOCK(cs_main);
@@ -1448,6 +1499,208 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
+/**
+ * Act on the result of accepting a transaction received from pfrom to the
+ * mempool: relay it along with the orphans it completes, keep it as an
+ * orphan, or reject it. The transactions to relay are added to vRelay, for
+ * the caller to pass to RelayTransactions.
+ */
+static void ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, bool fAccepted, bool fMissingInputs, CValidationState& state, std::list<CTransactionRef>& lRemovedTxn, std::vector<uint256>& vRelay, CConnman* connman)
+{
+    AssertLockHeld(cs_main);
+    const CTransaction& tx = *ptx;
+    const CInv inv(MSG_TX, tx.GetHash());
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    std::deque<COutPoint> vWorkQueue;
+    std::vector<uint256> vEraseQueue;
+
+    if (fAccepted) {
+        mempool.check(pcoinsTip);
+        vRelay.push_back(inv.hash);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            vWorkQueue.emplace_back(inv.hash, i);
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->GetId(),
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        std::set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty()) {
+            auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (auto mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const CTransactionRef& porphanTx = (*mi)->second.tx;
+                const CTransaction& orphanTx = *porphanTx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
+                    LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+                    vRelay.push_back(orphanHash);
+                    for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanHash, i);
+                    }
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee
+                    LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions or
+                        // witness-stripped transactions, as they can have been malleated.
+                        // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
+                    }
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        for (uint256 hash : vEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+        for (const CTxIn& txin : tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(pfrom);
+            for (const CTxIn& txin : tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+            }
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            if (nEvicted > 0) {
+                LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
+            }
+        } else {
+            LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        if (!tx.HasWitness() && !state.CorruptionPossible()) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been malleated.
+            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
+            AddToCompactExtraTransactions(ptx);
+        }
+
+        if (pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
+                vRelay.push_back(inv.hash);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
+            }
+        }
+    }
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->GetId(),
+            FormatStateMessage(state));
+        if (state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, std::string(NetMsgType::TX), (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+        if (nDoS > 0) {
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+/** Accept a batch of transactions received from peers to the mempool, see ProcessMessage */
+static void AcceptTransactionBatch(std::vector<QueuedTx>& vBatch, CConnman* connman)
+{
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(vBatch.size());
+    for (const QueuedTx& queued : vBatch)
+        vtx.push_back(queued.second);
+    std::vector<CTxAcceptResult> vResults;
+    AcceptToMemoryPoolBatch(mempool, vtx, vResults, true, txAcceptQueue.get());
+
+    std::vector<uint256> vRelay;
+    {
+        LOCK(cs_main);
+        for (const CTransactionRef& ptx : vtx)
+            setTxAccepting.erase(ptx->GetHash());
+        for (size_t i = 0; i < vBatch.size(); i++) {
+            CNode* pfrom = vBatch[i].first;
+            CTxAcceptResult& result = vResults[i];
+            if (result.fMissingInputs) {
+                // The parents may have been accepted since, earlier in the
+                // batch or by another thread, after they looked for orphans
+                result.state = CValidationState();
+                result.fAccepted = AcceptToMemoryPool(mempool, result.state, vtx[i], true, &result.fMissingInputs, &result.lRemovedTxn);
+            }
+            ProcessTransaction(pfrom, vtx[i], result.fAccepted, result.fMissingInputs, result.state, result.lRemovedTxn, vRelay, connman);
+            pfrom->Release();
+        }
+    }
+    RelayTransactions(vRelay, connman);
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
@@ -2064,8 +2317,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -2083,160 +2334,28 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         std::list<CTransactionRef> lRemovedTxn;
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->GetId(),
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            for (const CTxIn& txin : tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom);
-                for (const CTxIn& txin : tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
-                }
-            } else {
-                LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
-            }
-        } else {
-            if (!tx.HasWitness() && !state.CorruptionPossible()) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been malleated.
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
-                AddToCompactExtraTransactions(ptx);
-            }
+        // Already being accepted on another thread. Unless it has to be
+        // force relayed for a whitelisted peer, whatever that thread makes of
+        // it: then it is accepted here too, and ProcessTransaction relays it.
+        bool fAccepting = setTxAccepting.count(inv.hash);
+        if (fAccepting && !(pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)))
+            return true;
 
-            if (pfrom->fWhitelisted && gArgs.GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
-                }
-            }
+        // Accept it along with the transactions other peers send meanwhile,
+        // checking their scripts in parallel and without cs_main held
+        if (txBatchQueue && !fAccepting && !AlreadyHave(inv)) {
+            setTxAccepting.insert(inv.hash);
+            pfrom->AddRef();
+            if (txBatchQueue->Add(QueuedTx(pfrom, ptx)))
+                return true;
+            setTxAccepting.erase(inv.hash);
+            pfrom->Release();
         }
 
-        for (const CTransactionRef& removedTx : lRemovedTxn)
-            AddToCompactExtraTransactions(removedTx);
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->GetId(),
-                FormatStateMessage(state));
-            if (state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
+        bool fAccepted = !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn);
+        std::vector<uint256> vRelay;
+        ProcessTransaction(pfrom, ptx, fAccepted, fMissingInputs, state, lRemovedTxn, vRelay, connman);
+        RelayTransactions(vRelay, connman);
     }
 
 
@@ -18,6 +18,16 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -txacceptthreads, the number of threads checking the scripts of batches of transactions from peers */
+static const int DEFAULT_TX_ACCEPT_THREADS = 4;
+/** Maximum number of transaction accepting threads allowed */
+static const int MAX_TX_ACCEPT_THREADS = 64;
+/** Transactions waiting to be accepted before the message handler accepts them itself */
+static const size_t MAX_TX_ACCEPT_QUEUE = 1000;
+/** Default for -txbatchwindow, how long transactions from peers are collected into a batch, in milliseconds */
+static const int64_t DEFAULT_TX_BATCH_WINDOW = 50;
+/** Maximum number of transactions accepted to the mempool as one batch */
+static const size_t MAX_TX_BATCH_SIZE = 500;
 /** Headers download timeout expressed in microseconds
  *  Timeout = base + per_header * (expected number of headers) */
 static constexpr int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000; // 15 minutes
@@ -41,6 +51,7 @@ private:
 
 public:
     explicit PeerLogicValidation(CConnman* connman, CScheduler &scheduler);
+    ~PeerLogicValidation();
 
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected, const std::vector<CTransactionRef>& vtxConflicted) override;
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
@@ -65,6 +76,9 @@ public:
     void CheckForStaleTipAndEvictPeers(const Consensus::Params &consensusParams);
     void EvictExtraOutboundPeers(int64_t time_in_seconds);
 
+    /** Finish the transactions queued for the accept threads; later ones are accepted by the message handler */
+    void StopTxAcceptThreads();
+
 private:
     int64_t m_stale_tip_check_time; //! Next time to check for stale tip
 };
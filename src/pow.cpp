@@ -8,11 +8,35 @@
 #include "arith_uint256.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "crypto/common.h"
 #include "primitives/block.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 #include "validation.h"
 
+/** Guards CBlockIndex::nNextWorkRequired, which is also read by miner threads not holding cs_main */
+static CCriticalSection cs_nextwork;
+
+/**
+ * Divide by a small number one 32-bit word at a time. Gives the same result
+ * as arith_uint256's operator/, which subtracts bit by bit and dominates the
+ * cost of a retarget.
+ */
+static arith_uint256 DivideBySmall(const arith_uint256& n, uint32_t nDivisor)
+{
+    assert(nDivisor != 0);
+    uint256 num = ArithToUint256(n);
+    uint256 quotient;
+    uint64_t nRemainder = 0;
+    for (int i = 256 / 32 - 1; i >= 0; i--) {
+        uint64_t nPart = (nRemainder << 32) | ReadLE32(num.begin() + 4 * i);
+        WriteLE32(quotient.begin() + 4 * i, nPart / nDivisor);
+        nRemainder = nPart % nDivisor;
+    }
+    return UintToArith256(quotient);
+}
+
 unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const Consensus::Params& params) {
     /* current difficulty formula, dash - DarkGravity v3, written by Evan Duffield - evan@dashpay.io */
     const CBlockIndex *pBlockLastSolved = pindexLast;
@@ -40,7 +64,7 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const Consens
             if (nCountBlocks == 1) {
                 bnPastDifficultyAverage.SetCompact (pBlockReading->nBits); 
             } else { 
-                bnPastDifficultyAverage = ((bnPastDifficultyAveragePrev * nCountBlocks) + (arith_uint256().SetCompact(pBlockReading->nBits))) / (nCountBlocks + 1); 
+                bnPastDifficultyAverage = DivideBySmall((bnPastDifficultyAveragePrev * (uint32_t)nCountBlocks) + (arith_uint256().SetCompact(pBlockReading->nBits)), nCountBlocks + 1);
             }
             bnPastDifficultyAveragePrev = bnPastDifficultyAverage;
         }
@@ -71,7 +95,7 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const Consens
 
     // Retarget
     bnNew *= nActualTimespan;
-    bnNew /= _nTargetTimespan;
+    bnNew = DivideBySmall(bnNew, _nTargetTimespan);
 
     if (bnNew > bnPowLimit) {
         bnNew = bnPowLimit;
@@ -87,7 +111,18 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if (pindexLast->nHeight < 100) // for tests
         return UintToArith256(params.powLimit).GetCompact();
 
-    return DarkGravityWave (pindexLast, params);
+    // The result only depends on the chain up to pindexLast, so it is
+    // computed once per block and shared by header checks, UpdateTime and
+    // block template creation.
+    {
+        LOCK(cs_nextwork);
+        if (pindexLast->nNextWorkRequired != 0)
+            return pindexLast->nNextWorkRequired;
+    }
+    unsigned int nBits = DarkGravityWave(pindexLast, params);
+    LOCK(cs_nextwork);
+    pindexLast->nNextWorkRequired = nBits;
+    return nBits;
 }
 
 unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params& params)
@@ -17,19 +17,20 @@ uint256 CBlockHeader::GetHash() const
     return SerializeHash (*this);
 }
 
+const yespower_params_t yespower_1_0_faircoin = {
+    .version = YESPOWER_1_0,
+    .N = 2048,
+    .r = 32,
+    .pers = (const uint8_t *)"LTNCGYES",
+    .perslen = 8
+};
+
 uint256 CBlockHeader::GetHashYespower() const
 {
     uint256 thash;
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << *this;
-    yespower_params_t yespower_1_0_inter = {
-        .version = YESPOWER_1_0,
-        .N = 2048,
-        .r = 32,
-        .pers = (const uint8_t *)"LTNCGYES",
-        .perslen = 8 
-    };
-    if (yespower_tls( (unsigned char *)&ss[0], ss.size(), &yespower_1_0_inter, (yespower_binary_t *)&thash) ) {
+    if (yespower_tls( (unsigned char *)&ss[0], ss.size(), &yespower_1_0_faircoin, (yespower_binary_t *)&thash) ) {
         abort();
     }
     return thash;
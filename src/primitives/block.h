@@ -9,6 +9,13 @@
 #include "primitives/transaction.h"
 #include "serialize.h"
 #include "uint256.h"
+#include "yespower/yespower.h"
+
+/** Size of a serialized block header, which is the input of the yespower hash */
+static const size_t BLOCK_HEADER_SIZE = 80;
+
+/** yespower parameters of the FairCoin proof of work */
+extern const yespower_params_t yespower_1_0_faircoin;
 
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
@@ -348,27 +348,23 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+void entryToJSON(UniValue &info, const CTxMemPoolSnapshot::Entry &e)
 {
-    AssertLockHeld(mempool.cs);
-
-    info.push_back(Pair("size", (int)e.GetTxSize()));
-    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-    info.push_back(Pair("time", e.GetTime()));
-    info.push_back(Pair("height", (int)e.GetHeight()));
-    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-    info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
-    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
-    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
-    info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    const CTransaction& tx = e.GetTx();
+    info.push_back(Pair("size", (int)e.nTxSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants));
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants));
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants));
+    info.push_back(Pair("ancestorcount", e.nCountWithAncestors));
+    info.push_back(Pair("ancestorsize", e.nSizeWithAncestors));
+    info.push_back(Pair("ancestorfees", e.nModFeesWithAncestors));
     std::set<std::string> setDepends;
-    for (const CTxIn& txin : tx.vin)
+    for (const uint256& parent : e.vParents)
     {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
+        setDepends.insert(parent.ToString());
     }
 
     UniValue depends(UniValue::VARR);
@@ -384,11 +380,12 @@ UniValue mempoolToJSON(bool fVerbose)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
+        // Formatted from a snapshot, so a large pool doesn't hold up admission
+        std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->vEntries)
         {
-            const uint256& hash = e.GetTx().GetHash();
+            const uint256& hash = e.tx->GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
             o.push_back(Pair(hash.ToString(), info));
@@ -472,30 +469,33 @@ UniValue getmempoolancestors(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot;
+    {
+        LOCK(mempool.cs);
 
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
-    }
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
+        }
 
-    CTxMemPool::setEntries setAncestors;
-    uint64_t noLimit = std::numeric_limits<uint64_t>::max();
-    std::string dummy;
-    mempool.CalculateMemPoolAncestors(*it, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
+        CTxMemPool::setEntries setAncestors;
+        uint64_t noLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*it, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
+        snapshot = mempool.GetSnapshot(setAncestors);
+    }
 
     if (!fVerbose) {
         UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            o.push_back(ancestorIt->GetTx().GetHash().ToString());
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->vEntries) {
+            o.push_back(e.tx->GetHash().ToString());
         }
 
         return o;
     } else {
         UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            const CTxMemPoolEntry &e = *ancestorIt;
-            const uint256& _hash = e.GetTx().GetHash();
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->vEntries) {
+            const uint256& _hash = e.tx->GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
             o.push_back(Pair(_hash.ToString(), info));
@@ -536,30 +536,33 @@ UniValue getmempooldescendants(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot;
+    {
+        LOCK(mempool.cs);
+
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
+        }
 
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
+        CTxMemPool::setEntries setDescendants;
+        mempool.CalculateDescendants(it, setDescendants);
+        // CTxMemPool::CalculateDescendants will include the given tx
+        setDescendants.erase(it);
+        snapshot = mempool.GetSnapshot(setDescendants);
     }
 
-    CTxMemPool::setEntries setDescendants;
-    mempool.CalculateDescendants(it, setDescendants);
-    // CTxMemPool::CalculateDescendants will include the given tx
-    setDescendants.erase(it);
-
     if (!fVerbose) {
         UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            o.push_back(descendantIt->GetTx().GetHash().ToString());
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->vEntries) {
+            o.push_back(e.tx->GetHash().ToString());
         }
 
         return o;
     } else {
         UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            const CTxMemPoolEntry &e = *descendantIt;
-            const uint256& _hash = e.GetTx().GetHash();
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->vEntries) {
+            const uint256& _hash = e.tx->GetHash();
             UniValue info(UniValue::VOBJ);
             entryToJSON(info, e);
             o.push_back(Pair(_hash.ToString(), info));
@@ -588,16 +591,19 @@ UniValue getmempoolentry(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot;
+    {
+        LOCK(mempool.cs);
 
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
+        }
+        snapshot = mempool.GetSnapshot(CTxMemPool::setEntries{it});
     }
 
-    const CTxMemPoolEntry &e = *it;
     UniValue info(UniValue::VOBJ);
-    entryToJSON(info, e);
+    entryToJSON(info, snapshot->vEntries[0]);
     return info;
 }
 
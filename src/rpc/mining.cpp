@@ -119,6 +119,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
     }
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
+    CHeaderSolver solver(GetNumCores());
     while (nHeight < nHeightEnd)
     {
         std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
@@ -129,12 +130,11 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && 
-                !CheckProofOfWork(pblock->GetHashYespower(), pblock->nBits, Params().GetConsensus())) 
-        {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
+        // Try the same nonces as a serial loop decrementing nMaxTries would
+        const uint32_t nNonceEnd = std::min<uint64_t>(nInnerLoopCount, pblock->nNonce + nMaxTries);
+        const uint32_t nNonceBegin = pblock->nNonce;
+        solver.Solve(*pblock, nNonceEnd, Params().GetConsensus());
+        nMaxTries -= pblock->nNonce - nNonceBegin;
         if (nMaxTries == 0) {
             break;
         }
@@ -284,6 +284,7 @@ UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    blockTemplateCache.Invalidate();
     return true;
 }
 
@@ -548,7 +549,10 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        if (fSupportsSegwit)
+            pblocktemplate = blockTemplateCache.Get(Params(), scriptDummy);
+        else
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
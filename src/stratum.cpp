@@ -0,0 +1,544 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "arith_uint256.h"
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "httprpc.h"
+#include "miner.h"
+#include "netbase.h"
+#include "pow.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+#include "validationinterface.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <set>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <univalue.h>
+
+/** Longest request line we accept from a miner */
+static const size_t MAX_STRATUM_LINE_LENGTH = 16384;
+/** Jobs kept per tip, so shares for slightly older work are still accepted */
+static const size_t MAX_STRATUM_JOBS = 8;
+/** How often to offer a new job with updated transactions, in seconds */
+static const int STRATUM_JOB_REFRESH_INTERVAL = 30;
+
+CStratumJob::CStratumJob(const CBlock& blockIn, int nHeight) : block(blockIn)
+{
+    CMutableTransaction txCoinbase(*block.vtx[0]);
+    CScript scriptSig = CScript() << nHeight;
+    const size_t nHeightSize = scriptSig.size();
+    scriptSig << std::vector<unsigned char>(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0);
+    scriptSig += COINBASE_FLAGS;
+    assert(scriptSig.size() <= 100);
+    txCoinbase.vin[0].scriptSig = scriptSig;
+    block.vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss << *block.vtx[0];
+    // nVersion, the input count and the prevout precede the scriptSig, then
+    // come the height and the opcode pushing the extranonce.
+    const size_t nOffset = 4 + 1 + 36 + GetSizeOfCompactSize(scriptSig.size()) + nHeightSize + 1;
+    vchCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    vchCoinbase2.assign(ss.begin() + nOffset + STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, ss.end());
+    vMerkleBranch = BlockMerkleBranch(block, 0);
+}
+
+std::vector<unsigned char> CStratumJob::GetCoinbase(const std::vector<unsigned char>& vchExtraNonce) const
+{
+    assert(vchExtraNonce.size() == STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE);
+    std::vector<unsigned char> vchCoinbase(vchCoinbase1);
+    vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce.begin(), vchExtraNonce.end());
+    vchCoinbase.insert(vchCoinbase.end(), vchCoinbase2.begin(), vchCoinbase2.end());
+    return vchCoinbase;
+}
+
+CBlockHeader CStratumJob::GetHeader(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const
+{
+    const std::vector<unsigned char> vchCoinbase = GetCoinbase(vchExtraNonce);
+    CBlockHeader header = block.GetBlockHeader();
+    header.hashMerkleRoot = ComputeMerkleRootFromBranch(Hash(vchCoinbase.begin(), vchCoinbase.end()), vMerkleBranch, 0);
+    header.nTime = nTime;
+    header.nNonce = nNonce;
+    return header;
+}
+
+CBlock CStratumJob::GetBlock(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const
+{
+    CDataStream ss(GetCoinbase(vchExtraNonce), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    CMutableTransaction txCoinbase;
+    ss >> txCoinbase;
+    // The witness nonce backing the witness commitment is not part of the txid
+    txCoinbase.vin[0].scriptWitness = block.vtx[0]->vin[0].scriptWitness;
+
+    CBlock blockOut(block);
+    blockOut.vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    blockOut.hashMerkleRoot = BlockMerkleRoot(blockOut);
+    blockOut.nTime = nTime;
+    blockOut.nNonce = nNonce;
+    return blockOut;
+}
+
+/** A connected miner. Only touched from the stratum event thread. */
+struct StratumClient
+{
+    struct bufferevent* bev;
+    std::string strAddress;
+    std::vector<unsigned char> vchExtraNonce1;
+    bool fAuthorized;
+
+    StratumClient(struct bufferevent* bevIn, const std::string& strAddressIn, uint32_t nExtraNonce1) :
+        bev(bevIn), strAddress(strAddressIn), vchExtraNonce1(STRATUM_EXTRANONCE1_SIZE), fAuthorized(false)
+    {
+        WriteBE32(vchExtraNonce1.data(), nExtraNonce1);
+    }
+
+    ~StratumClient()
+    {
+        bufferevent_free(bev);
+    }
+};
+
+/** Posts a new job when the tip changes */
+class CStratumNotifier : public CValidationInterface
+{
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+};
+
+static struct event_base* stratumBase = nullptr;
+static std::vector<struct evconnlistener*> vStratumListeners;
+static struct event* stratumNewTipEvent = nullptr;
+static struct event* stratumRefreshEvent = nullptr;
+static boost::thread stratumThread;
+static CStratumNotifier stratumNotifier;
+
+// Everything below is owned by the stratum event thread once it is started
+static std::map<struct bufferevent*, std::unique_ptr<StratumClient>> mapStratumClients;
+static std::map<uint32_t, std::shared_ptr<const CStratumJob>> mapStratumJobs;
+//! Hashes of the shares submitted for each job in mapStratumJobs
+static std::map<uint32_t, std::set<uint256>> mapStratumShares;
+static uint32_t nStratumJobId = 0;
+static uint32_t nStratumExtraNonce1 = 0;
+static unsigned int nStratumTransactionsUpdated = 0;
+static CScript stratumScriptPubKey;
+static double dStratumDifficulty;
+static arith_uint256 stratumShareTarget;
+
+void CStratumNotifier::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (!fInitialDownload)
+        event_active(stratumNewTipEvent, 0, 0);
+}
+
+/** Parse eight hex digits as a big-endian 32-bit number, the way Stratum sends them */
+static bool ParseStratumHex32(const UniValue& value, uint32_t& n)
+{
+    if (!value.isStr() || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    n = strtoul(value.get_str().c_str(), nullptr, 16);
+    return true;
+}
+
+/** Stratum sends the previous block hash with the bytes of every 32-bit word swapped */
+static std::string StratumPrevHash(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    for (size_t i = 0; i < vch.size(); i += 4)
+        std::reverse(vch.begin() + i, vch.begin() + i + 4);
+    return HexStr(vch);
+}
+
+static UniValue StratumError(int nCode, const std::string& strMessage)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(nCode);
+    error.push_back(strMessage);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+static void StratumSend(StratumClient& client, const UniValue& msg)
+{
+    const std::string str = msg.write() + "\n";
+    bufferevent_write(client.bev, str.data(), str.size());
+}
+
+static void StratumReply(StratumClient& client, const UniValue& id, const UniValue& result, const UniValue& error = NullUniValue)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", error));
+    StratumSend(client, reply);
+}
+
+static void StratumNotify(StratumClient& client, const std::string& strMethod, const UniValue& params)
+{
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", strMethod));
+    notification.push_back(Pair("params", params));
+    StratumSend(client, notification);
+}
+
+static UniValue StratumJobParams(uint32_t nJobId, const CStratumJob& job, bool fClean)
+{
+    UniValue branch(UniValue::VARR);
+    for (const uint256& hash : job.vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(strprintf("%08x", nJobId));
+    params.push_back(StratumPrevHash(job.block.hashPrevBlock));
+    params.push_back(HexStr(job.vchCoinbase1));
+    params.push_back(HexStr(job.vchCoinbase2));
+    params.push_back(branch);
+    params.push_back(strprintf("%08x", job.block.nVersion));
+    params.push_back(strprintf("%08x", job.block.nBits));
+    params.push_back(strprintf("%08x", job.block.nTime));
+    params.push_back(fClean);
+    return params;
+}
+
+bool GetStratumShareTarget(double dDifficulty, arith_uint256& target)
+{
+    if (!(dDifficulty > 0))
+        return false;
+    // 0x00000000ffff0000... / dDifficulty, as a 53-bit mantissa and an exponent
+    int nExponent;
+    const double dMantissa = std::frexp(std::ldexp(0xffff, 208) / dDifficulty, &nExponent);
+    if (nExponent > 256)
+        return false;
+    target = arith_uint256((uint64_t)std::ldexp(dMantissa, 53));
+    if (nExponent >= 53)
+        target <<= nExponent - 53;
+    else
+        target >>= 53 - nExponent;
+    return true;
+}
+
+/** Build a job from a new block template and push it to all miners */
+static void NewStratumJob(bool fClean)
+{
+    nStratumTransactionsUpdated = mempool.GetTransactionsUpdated();
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        pblocktemplate = blockTemplateCache.Get(Params(), stratumScriptPubKey);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("stratum: cannot create block template: %s\n", e.what());
+        return;
+    }
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(pblocktemplate->block.hashPrevBlock);
+        assert(mi != mapBlockIndex.end());
+        nHeight = mi->second->nHeight + 1;
+    }
+
+    if (fClean) {
+        mapStratumJobs.clear();
+        mapStratumShares.clear();
+    }
+    const uint32_t nJobId = ++nStratumJobId;
+    auto job = std::make_shared<const CStratumJob>(pblocktemplate->block, nHeight);
+    mapStratumJobs[nJobId] = job;
+    while (mapStratumJobs.size() > MAX_STRATUM_JOBS) {
+        mapStratumShares.erase(mapStratumJobs.begin()->first);
+        mapStratumJobs.erase(mapStratumJobs.begin());
+    }
+    LogPrint(BCLog::STRATUM, "stratum: job %08x at height %d with %u transactions\n", nJobId, nHeight, job->block.vtx.size());
+
+    const UniValue params = StratumJobParams(nJobId, *job, fClean);
+    for (auto& client : mapStratumClients) {
+        if (client.second->fAuthorized)
+            StratumNotify(*client.second, "mining.notify", params);
+    }
+}
+
+static UniValue StratumSubmit(StratumClient& client, const UniValue& params)
+{
+    if (!client.fAuthorized)
+        return StratumError(24, "Unauthorized worker");
+
+    uint32_t nJobId, nTime, nNonce;
+    if (params.size() < 5 || !ParseStratumHex32(params[1], nJobId) || !params[2].isStr()
+        || !ParseStratumHex32(params[3], nTime) || !ParseStratumHex32(params[4], nNonce))
+        return StratumError(20, "Invalid parameters");
+
+    const std::string& strExtraNonce2 = params[2].get_str();
+    if (strExtraNonce2.size() != 2 * STRATUM_EXTRANONCE2_SIZE || !IsHex(strExtraNonce2))
+        return StratumError(20, "Invalid extranonce2");
+
+    auto it = mapStratumJobs.find(nJobId);
+    if (it == mapStratumJobs.end())
+        return StratumError(21, "Job not found");
+    const CStratumJob& job = *it->second;
+
+    if (nTime < job.block.nTime || nTime > GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME)
+        return StratumError(20, "ntime out of range");
+
+    std::vector<unsigned char> vchExtraNonce(client.vchExtraNonce1);
+    const std::vector<unsigned char> vchExtraNonce2 = ParseHex(strExtraNonce2);
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+
+    const CBlockHeader header = job.GetHeader(vchExtraNonce, nTime, nNonce);
+    if (!mapStratumShares[nJobId].insert(header.GetHash()).second)
+        return StratumError(22, "Duplicate share");
+
+    const uint256 hashPoW = header.GetHashYespower();
+    const bool fBlock = CheckProofOfWork(hashPoW, header.nBits, Params().GetConsensus());
+    if (!fBlock && UintToArith256(hashPoW) > stratumShareTarget)
+        return StratumError(23, "Low difficulty share");
+
+    if (fBlock) {
+        std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(job.GetBlock(vchExtraNonce, nTime, nNonce));
+        LogPrintf("stratum: block %s found by %s\n", pblock->GetHash().ToString(), client.strAddress);
+        if (!ProcessNewBlock(Params(), pblock, true, nullptr))
+            LogPrintf("stratum: block %s not accepted\n", pblock->GetHash().ToString());
+    }
+    return NullUniValue;
+}
+
+/** Handle one request line. Returns false if the client should be disconnected. */
+static bool StratumHandleLine(StratumClient& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject()) {
+        LogPrint(BCLog::STRATUM, "stratum: malformed request from %s\n", client.strAddress);
+        return false;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr() || !params.isArray()) {
+        StratumReply(client, id, NullUniValue, StratumError(20, "Invalid request"));
+        return true;
+    }
+    const std::string& strMethod = method.get_str();
+
+    if (strMethod == "mining.subscribe") {
+        const std::string strSubscription = HexStr(client.vchExtraNonce1);
+        UniValue subscriptions(UniValue::VARR);
+        for (const char* pszMethod : {"mining.set_difficulty", "mining.notify"}) {
+            UniValue subscription(UniValue::VARR);
+            subscription.push_back(pszMethod);
+            subscription.push_back(strSubscription);
+            subscriptions.push_back(subscription);
+        }
+        UniValue result(UniValue::VARR);
+        result.push_back(subscriptions);
+        result.push_back(HexStr(client.vchExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        StratumReply(client, id, result);
+    } else if (strMethod == "mining.authorize") {
+        // Workers log in with the RPC credentials
+        if (params.size() < 2 || !params[0].isStr() || !params[1].isStr()
+            || !RPCCredentialsValid(params[0].get_str() + ":" + params[1].get_str())) {
+            LogPrintf("stratum: incorrect password attempt from %s\n", client.strAddress);
+            StratumReply(client, id, false, StratumError(24, "Unauthorized worker"));
+            return true;
+        }
+        client.fAuthorized = true;
+        StratumReply(client, id, true);
+
+        UniValue difficulty(UniValue::VARR);
+        difficulty.push_back(dStratumDifficulty);
+        StratumNotify(client, "mining.set_difficulty", difficulty);
+        if (!mapStratumJobs.empty()) {
+            auto last = mapStratumJobs.rbegin();
+            StratumNotify(client, "mining.notify", StratumJobParams(last->first, *last->second, true));
+        }
+    } else if (strMethod == "mining.submit") {
+        const UniValue error = StratumSubmit(client, params);
+        StratumReply(client, id, error.isNull(), error);
+    } else if (strMethod == "mining.extranonce.subscribe") {
+        // extranonce1 never changes for a connection
+        StratumReply(client, id, false);
+    } else {
+        StratumReply(client, id, NullUniValue, StratumError(20, "Unknown method"));
+    }
+    return true;
+}
+
+static void stratum_read_cb(struct bufferevent *bev, void *ctx)
+{
+    StratumClient* client = (StratumClient*)ctx;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char *line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != nullptr) {
+        const std::string strLine(line, n_read_out);
+        free(line);
+        if (!StratumHandleLine(*client, strLine)) {
+            mapStratumClients.erase(bev);
+            return;
+        }
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE_LENGTH) {
+        LogPrint(BCLog::STRATUM, "stratum: disconnecting %s, line too long\n", client->strAddress);
+        mapStratumClients.erase(bev);
+    }
+}
+
+static void stratum_event_cb(struct bufferevent *bev, short what, void *ctx)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+        LogPrint(BCLog::STRATUM, "stratum: %s disconnected\n", ((StratumClient*)ctx)->strAddress);
+        mapStratumClients.erase(bev);
+    }
+}
+
+static void stratum_accept_cb(struct evconnlistener *listener, evutil_socket_t fd, struct sockaddr *addr, int socklen, void *ctx)
+{
+    struct bufferevent *bev = bufferevent_socket_new(stratumBase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    CService peer;
+    peer.SetSockAddr(addr);
+    std::unique_ptr<StratumClient> client(new StratumClient(bev, peer.ToString(), ++nStratumExtraNonce1));
+    bufferevent_setcb(bev, stratum_read_cb, nullptr, stratum_event_cb, client.get());
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    LogPrint(BCLog::STRATUM, "stratum: accepted connection from %s\n", client->strAddress);
+    mapStratumClients[bev] = std::move(client);
+}
+
+static void stratum_new_tip_cb(evutil_socket_t, short, void*)
+{
+    NewStratumJob(true);
+}
+
+static void stratum_refresh_cb(evutil_socket_t, short, void*)
+{
+    if (mempool.GetTransactionsUpdated() != nStratumTransactionsUpdated)
+        NewStratumJob(false);
+}
+
+static void ThreadStratumServer()
+{
+    NewStratumJob(true);
+    event_base_dispatch(stratumBase);
+    mapStratumClients.clear();
+    mapStratumJobs.clear();
+    mapStratumShares.clear();
+}
+
+bool StartStratumServer()
+{
+    assert(!stratumBase);
+    const CBitcoinAddress address(gArgs.GetArg("-coinbaseaddress", ""));
+    if (!address.IsValid())
+        return InitError(_("-stratum requires a valid -coinbaseaddress"));
+    stratumScriptPubKey = GetScriptForDestination(address.Get());
+    // Workers log in with the RPC credentials, which only exist with -server
+    if (!gArgs.GetBoolArg("-server", false))
+        return InitError(_("-stratum requires -server"));
+
+    dStratumDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+    if (gArgs.IsArgSet("-stratumdifficulty") && !ParseDouble(gArgs.GetArg("-stratumdifficulty", ""), &dStratumDifficulty))
+        return InitError(strprintf(_("Invalid -stratumdifficulty: '%s'"), gArgs.GetArg("-stratumdifficulty", "")));
+    if (!GetStratumShareTarget(dStratumDifficulty, stratumShareTarget) || stratumShareTarget > UintToArith256(Params().GetConsensus().powLimit))
+        return InitError(strprintf(_("-stratumdifficulty is too low, shares would be easier than blocks at the proof-of-work limit: '%s'"), gArgs.GetArg("-stratumdifficulty", "")));
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase)
+        return InitError(_("Unable to create the stratum event base"));
+
+    // Free the event base and the listeners bound so far on failure
+    auto fail = [](const std::string& strError) {
+        StopStratumServer();
+        return InitError(strError);
+    };
+
+    const int nPort = gArgs.GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    std::vector<std::string> vBind = gArgs.GetArgs("-stratumbind");
+    if (vBind.empty())
+        vBind.push_back("127.0.0.1");
+    for (const std::string& strBind : vBind) {
+        CService addrBind;
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        if (!Lookup(strBind.c_str(), addrBind, nPort, false) || !addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+            return fail(strprintf(_("Cannot resolve -stratumbind address: '%s'"), strBind));
+        struct evconnlistener *listener = evconnlistener_new_bind(stratumBase, stratum_accept_cb, nullptr,
+            LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (struct sockaddr*)&sockaddr, len);
+        if (!listener)
+            return fail(strprintf(_("Unable to bind stratum server to %s"), addrBind.ToString()));
+        LogPrintf("stratum: listening on %s\n", addrBind.ToString());
+        vStratumListeners.push_back(listener);
+    }
+
+    stratumNewTipEvent = event_new(stratumBase, -1, 0, stratum_new_tip_cb, nullptr);
+    stratumRefreshEvent = event_new(stratumBase, -1, EV_PERSIST, stratum_refresh_cb, nullptr);
+    struct timeval tv = {STRATUM_JOB_REFRESH_INTERVAL, 0};
+    event_add(stratumRefreshEvent, &tv);
+    RegisterValidationInterface(&stratumNotifier);
+
+    stratumThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &ThreadStratumServer));
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    if (stratumBase)
+        event_base_loopbreak(stratumBase);
+}
+
+void StopStratumServer()
+{
+    if (!stratumBase)
+        return;
+    if (stratumNewTipEvent)
+        UnregisterValidationInterface(&stratumNotifier);
+    event_base_loopbreak(stratumBase);
+    if (stratumThread.joinable())
+        stratumThread.join();
+
+    for (struct evconnlistener *listener : vStratumListeners)
+        evconnlistener_free(listener);
+    vStratumListeners.clear();
+    if (stratumNewTipEvent) {
+        event_free(stratumNewTipEvent);
+        stratumNewTipEvent = nullptr;
+    }
+    if (stratumRefreshEvent) {
+        event_free(stratumRefreshEvent);
+        stratumRefreshEvent = nullptr;
+    }
+    event_base_free(stratumBase);
+    stratumBase = nullptr;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Stratum work server for external miners.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "arith_uint256.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+static const bool DEFAULT_STRATUM_ENABLE = false;
+static const unsigned short DEFAULT_STRATUM_PORT = 3333;
+/** Share difficulty; difficulty 1 is about 2^32 hashes per share, see GetStratumShareTarget */
+static const double DEFAULT_STRATUM_DIFFICULTY = 0.000001;
+/** Bytes of the extranonce assigned by the server to each connection */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+/** Bytes of the extranonce rolled by the miner */
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+
+/**
+ * A block template handed out as a Stratum job. The coinbase scriptSig holds
+ * an extranonce placeholder, and its serialization is split around it, so a
+ * share only costs one coinbase hash, a merkle branch and a yespower hash.
+ */
+class CStratumJob
+{
+public:
+    CBlock block;
+    /** Serialized coinbase (without witness) before and after the extranonce */
+    std::vector<unsigned char> vchCoinbase1;
+    std::vector<unsigned char> vchCoinbase2;
+    /** Merkle branch of the coinbase */
+    std::vector<uint256> vMerkleBranch;
+
+    /** Take block, whose coinbase is at nHeight, and make room for the extranonce in its coinbase */
+    CStratumJob(const CBlock& blockIn, int nHeight);
+
+    /** Serialized coinbase with the given extranonce (extranonce1 followed by extranonce2) */
+    std::vector<unsigned char> GetCoinbase(const std::vector<unsigned char>& vchExtraNonce) const;
+    /** Header of a share */
+    CBlockHeader GetHeader(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const;
+    /** Full block of a share that meets the block target */
+    CBlock GetBlock(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const;
+};
+
+/**
+ * Share target for a Stratum difficulty. Difficulty 1 is the target
+ * 0x00000000ffff0000..., as on other Stratum servers. Returns false if the
+ * target does not fit in 256 bits.
+ */
+bool GetStratumShareTarget(double dDifficulty, arith_uint256& target);
+
+bool StartStratumServer();
+void InterruptStratumServer();
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
@@ -138,6 +138,68 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from an existing byte range without copying it
+ *
+ * The referenced memory must outlive the stream
+ */
+class CSpanReader
+{
+ public:
+
+/*
+ * @param[in]  nTypeIn Serialization Type
+ * @param[in]  nVersionIn Serialization Version (including any flags)
+ * @param[in]  pbeginIn  Start of the range to read from
+ * @param[in]  nSizeIn  Size of the range in bytes
+*/
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, size_t nSizeIn) : nType(nTypeIn), nVersion(nVersionIn), pend(pbeginIn + nSizeIn), pcur(pbeginIn) {}
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur)) {
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        }
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+    void ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur)) {
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        }
+        pcur += nSize;
+    }
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    //! Number of bytes not read yet
+    size_t size() const
+    {
+        return pend - pcur;
+    }
+    bool empty() const
+    {
+        return pcur == pend;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const char* const pend;
+    const char* pcur;
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
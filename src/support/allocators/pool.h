@@ -0,0 +1,175 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource for the many small, equally sized allocations of a
+ * node-based container like std::unordered_map.
+ *
+ * Blocks are carved off large chunks with a bump pointer, so they carry no
+ * malloc header and lie next to each other in memory. Freed blocks go on a
+ * free list per size and are reused first. Chunks are only released when the
+ * resource is destroyed, all at once. Requests larger than MAX_BLOCK_SIZE_BYTES
+ * (like a hash table's bucket array) are passed on to operator new.
+ *
+ * ALIGN_BYTES must be a power of two, at least the size of a pointer and at
+ * most the alignment operator new guarantees.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    struct ListNode {
+        ListNode* next;
+    };
+
+    static_assert(ALIGN_BYTES >= sizeof(ListNode) && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two, at least the size of a pointer");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "ALIGN_BYTES must not exceed the alignment of operator new");
+
+    const std::size_t nChunkSizeBytes;
+    std::vector<char*> vChunks;
+    //! Free lists by block size, in units of ALIGN_BYTES
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1> vFreeLists;
+    //! Unused part of the newest chunk
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+
+    static std::size_t NumAlignUnits(std::size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    static bool IsPooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t nUnits)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = vFreeLists[nUnits];
+        vFreeLists[nUnits] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Keep the tail of the current chunk for later requests of that size
+        if (pAvailableBegin != pAvailableEnd)
+            PushFree(pAvailableBegin, (pAvailableEnd - pAvailableBegin) / ALIGN_BYTES);
+        pAvailableBegin = static_cast<char*>(::operator new(nChunkSizeBytes));
+        pAvailableEnd = pAvailableBegin + nChunkSizeBytes;
+        vChunks.push_back(pAvailableBegin);
+    }
+
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 * 1024;
+
+    explicit PoolResource(std::size_t nChunkSizeBytesIn = DEFAULT_CHUNK_SIZE_BYTES)
+        : nChunkSizeBytes(nChunkSizeBytesIn / ALIGN_BYTES * ALIGN_BYTES), pAvailableBegin(nullptr), pAvailableEnd(nullptr)
+    {
+        vFreeLists.fill(nullptr);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (char* chunk : vChunks)
+            ::operator delete(chunk);
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment))
+            return ::operator new(bytes);
+
+        const std::size_t nUnits = NumAlignUnits(bytes);
+        if (vFreeLists[nUnits] != nullptr) {
+            ListNode* node = vFreeLists[nUnits];
+            vFreeLists[nUnits] = node->next;
+            return node;
+        }
+        const std::size_t nBytes = nUnits * ALIGN_BYTES;
+        if (nBytes > static_cast<std::size_t>(pAvailableEnd - pAvailableBegin))
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPooled(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumAlignUnits(bytes));
+    }
+
+    std::size_t NumChunks() const { return vChunks.size(); }
+    std::size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource, which must outlive it and
+ * all memory allocated through it.
+ */
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resourceIn) noexcept : resource(resourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : resource(other.GetResource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* GetResource() const noexcept { return resource; }
+
+private:
+    ResourceType* resource;
+};
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -4,9 +4,12 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bitcoin.h"
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,51 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 0U);
+
+    // Blocks are bump allocated, rounded up to the alignment
+    char* a = static_cast<char*>(resource.Allocate(8, 8));
+    char* b = static_cast<char*>(resource.Allocate(5, 4));
+    char* c = static_cast<char*>(resource.Allocate(24, 8));
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 1U);
+    BOOST_CHECK(b == a + 8);
+    BOOST_CHECK(c == b + 8);
+
+    // Freed blocks are reused for the same size only
+    resource.Deallocate(c, 24, 8);
+    BOOST_CHECK(resource.Allocate(8, 8) == c + 24);
+    BOOST_CHECK(resource.Allocate(17, 8) == c);
+
+    // Large or over-aligned requests bypass the pool
+    void* big = resource.Allocate(65, 8);
+    void* aligned = resource.Allocate(16, 16);
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 1U);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 16, 16);
+
+    // A new chunk is started when the current one is used up
+    for (int i = 0; i < 1024 / 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_tests)
+{
+    typedef PoolAllocator<std::pair<const int, int>, 64, alignof(void*)> Allocator;
+    Allocator::ResourceType resource;
+    {
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator> map(0, std::hash<int>(), std::equal_to<int>(), &resource);
+        for (int i = 0; i < 10000; i++)
+            map[i] = i;
+        for (int i = 0; i < 10000; i += 2)
+            map.erase(i);
+        for (int i = 0; i < 10000; i++)
+            BOOST_CHECK_EQUAL(map.count(i), (size_t)(i % 2));
+        BOOST_CHECK(resource.NumChunks() > 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
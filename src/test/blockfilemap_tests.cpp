@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "validation.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+static void AppendToFile(const fs::path& path, const std::vector<unsigned char>& vch)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(vch.data(), 1, vch.size(), file), vch.size());
+    fclose(file);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(blockfilemap_get)
+{
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+    std::vector<unsigned char> vchHeader = {0xfa, 0xbf, 0xb5, 0xda, 3, 0, 0, 0};
+    AppendToFile(path, vchHeader);
+    AppendToFile(path, {1, 2, 3});
+
+    CBlockFileMap map(2);
+    CBlockFileSpan span;
+    BOOST_CHECK(map.GetBlock(path, CDiskBlockPos(0, 8), span));
+    BOOST_CHECK_EQUAL(span.nSize, 3);
+    BOOST_CHECK(std::vector<unsigned char>(span.pbegin, span.pbegin + span.nSize) == std::vector<unsigned char>({1, 2, 3}));
+
+    // Past the end of the file
+    CBlockFileSpan span2;
+    BOOST_CHECK(!map.Get(path, CDiskBlockPos(0, 8), 4, span2));
+    BOOST_CHECK(!map.GetBlock(path, CDiskBlockPos(0, 4), span2));
+
+    // Appended data is found by mapping the file again; the old span stays valid
+    vchHeader[4] = 2;
+    AppendToFile(path, vchHeader);
+    AppendToFile(path, {4, 5});
+    BOOST_CHECK(map.GetBlock(path, CDiskBlockPos(0, 19), span2));
+    BOOST_CHECK(std::vector<unsigned char>(span2.pbegin, span2.pbegin + span2.nSize) == std::vector<unsigned char>({4, 5}));
+    BOOST_CHECK(span.file != span2.file);
+    BOOST_CHECK_EQUAL(span.pbegin[2], 3);
+
+    // Evicted and invalidated files stay mapped while a span uses them
+    std::vector<fs::path> vPaths;
+    for (int i = 0; i < 3; i++) {
+        vPaths.push_back(fs::temp_directory_path() / fs::unique_path());
+        AppendToFile(vPaths.back(), {(unsigned char)i});
+        CBlockFileSpan span3;
+        BOOST_CHECK(map.Get(vPaths.back(), CDiskBlockPos(0, 0), 1, span3));
+    }
+    map.Invalidate(path);
+    BOOST_CHECK_EQUAL(span.pbegin[0], 1);
+    BOOST_CHECK_EQUAL(span2.pbegin[1], 5);
+
+    // A file that got shorter than its mapping is dropped on a lookup past
+    // the end of the mapping, and not read past its new end
+    BOOST_CHECK(map.GetBlock(path, CDiskBlockPos(0, 19), span2));
+    std::shared_ptr<const CMappedBlockFile> fileOld = span2.file;
+    fs::resize_file(path, 12);
+    BOOST_CHECK(!map.Get(path, CDiskBlockPos(0, 19), 3, span2));
+    BOOST_CHECK(!map.GetBlock(path, CDiskBlockPos(0, 19), span2));
+    BOOST_CHECK(map.Get(path, CDiskBlockPos(0, 8), 3, span2));
+    BOOST_CHECK(span2.file != fileOld);
+    BOOST_CHECK_EQUAL(span2.pbegin[2], 3);
+
+    map.Clear();
+    fs::remove(path);
+    for (const fs::path& p : vPaths)
+        fs::remove(p);
+}
+#endif
+
+BOOST_FIXTURE_TEST_CASE(blockfilemap_read_blocks, TestChain100Setup)
+{
+    // Blocks read back through the mapped files and through stdio agree
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, consensusParams));
+
+        CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(), true), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!filein.IsNull());
+        CBlock blockFile;
+        filein >> blockFile;
+        BOOST_CHECK(block.GetHash() == blockFile.GetHash());
+        BOOST_CHECK_EQUAL(block.vtx.size(), blockFile.vtx.size());
+        BOOST_CHECK(block.vtx[0]->GetHash() == blockFile.vtx[0]->GetHash());
+
+        // The raw block is the network serialization, with and without witnesses here
+        std::vector<unsigned char> vchRaw;
+        BOOST_CHECK(ReadRawBlockFromDisk(vchRaw, pindex, Params().MessageStart()));
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+        BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchRaw);
+        CDataStream ssNoWitness(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        ssNoWitness << block;
+        BOOST_CHECK(std::vector<unsigned char>(ssNoWitness.begin(), ssNoWitness.end()) == vchRaw);
+    }
+
+    // The wrong block
+    std::vector<unsigned char> vchRaw;
+    CBlockIndex index(*chainActive.Tip());
+    index.phashBlock = chainActive.Genesis()->phashBlock;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchRaw, &index, Params().MessageStart()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,8 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "coins.h"
+#include "coinsprefetch.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -120,6 +123,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool found_an_entry = false;
     bool missed_an_entry = false;
     bool uncached_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<COutPoint, Coin> result;
@@ -210,7 +214,18 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (InsecureRandBool()) {
+                    stack[flushIndex]->Flush();
+                } else {
+                    // Write the changes to the base the way the background writer does
+                    CCoinsView* syncBase = flushIndex > 0 ? static_cast<CCoinsView*>(stack[flushIndex - 1]) : &base;
+                    CCoinsMapMemoryResource resource;
+                    CCoinsMap mapSync(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource);
+                    stack[flushIndex]->Sync(mapSync, InsecureRandBool());
+                    BOOST_CHECK(syncBase->BatchWrite(mapSync, stack[flushIndex]->GetBestBlock()));
+                    stack[flushIndex]->SelfTest();
+                    synced_a_cache = true;
+                }
             }
         }
         if (InsecureRandRange(100) == 0) {
@@ -253,6 +268,118 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
     BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(synced_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_background_write)
+{
+    // Small batches, so the writer commits many of them
+    gArgs.ForceSetArg("-dbbatchsize", "1000");
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCacheTest cache(&db);
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i, CScript() << OP_TRUE), 1, false), false);
+    }
+    uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+
+    // The coins are readable while being written, and stay in the cache
+    BOOST_CHECK(db.BatchWriteAsync(cache, false));
+    for (const COutPoint& outpoint : outpoints)
+        BOOST_CHECK(db.HaveCoin(outpoint));
+    BOOST_CHECK(db.WaitForPendingWrites());
+    BOOST_CHECK(!db.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    for (const auto& entry : cache.map())
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+    cache.SelfTest();
+
+    // Spends reach the database too, and evicting empties the cache
+    for (size_t i = 0; i < outpoints.size(); i += 2)
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(db.BatchWriteAsync(cache, true));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+    for (size_t i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(cache.HaveCoin(outpoints[i]), i % 2 == 1);
+    BOOST_CHECK(db.WaitForPendingWrites());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK_EQUAL(db.PendingMemoryUsage(), 0);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin coin;
+        BOOST_CHECK_EQUAL(db.GetCoin(outpoints[i], coin), i % 2 == 1);
+    }
+    gArgs.ForceSetArg("-dbbatchsize", std::to_string(nDefaultDbBatchSize));
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CMutableTransaction funding;
+    funding.vin.resize(1);
+    funding.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    for (int i = 0; i < 50; i++)
+        funding.vout.emplace_back(i + 1, CScript() << OP_TRUE);
+    {
+        CCoinsViewCache fundingCache(&db);
+        AddCoins(fundingCache, funding, 1);
+        fundingCache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(fundingCache.Flush());
+    }
+
+    // Spend 40 funded coins, one created in the block itself and a missing one
+    CMutableTransaction coinbase, spend, spendChild, spendMissing;
+    coinbase.vin.resize(1);
+    coinbase.vout.emplace_back(1, CScript() << OP_TRUE);
+    for (int i = 0; i < 40; i++)
+        spend.vin.emplace_back(COutPoint(funding.GetHash(), i));
+    spend.vout.emplace_back(1, CScript() << OP_TRUE);
+    spendChild.vin.emplace_back(COutPoint(spend.GetHash(), 0));
+    spendMissing.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    CBlock block;
+    block.vtx = {MakeTransactionRef(coinbase), MakeTransactionRef(spend), MakeTransactionRef(spendChild), MakeTransactionRef(spendMissing)};
+    std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+
+    CCoinsViewCacheTest cache(&db);
+    // The cache's own entries are newer than what is prefetched
+    BOOST_CHECK(cache.SpendCoin(COutPoint(funding.GetHash(), 1)));
+    CCoinsPrefetcher prefetcher(3);
+    prefetcher.Start(block.GetHash(), pblock, &db);
+    BOOST_CHECK(prefetcher.Finish(block.GetHash(), cache) == pblock);
+    for (int i = 0; i < 50; i++)
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(COutPoint(funding.GetHash(), i)), i < 40 && i != 1);
+    BOOST_CHECK_EQUAL(cache.AccessCoin(COutPoint(funding.GetHash(), 7)).out.nValue, 8);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 40);
+    cache.SelfTest();
+
+    // Nothing is added for another block or after a cancel
+    CCoinsViewCacheTest cache2(&db);
+    prefetcher.Start(block.GetHash(), pblock, &db);
+    BOOST_CHECK(prefetcher.Finish(InsecureRand256(), cache2) == nullptr);
+    prefetcher.Start(block.GetHash(), pblock, &db);
+    prefetcher.Cancel();
+    BOOST_CHECK(prefetcher.Finish(block.GetHash(), cache2) == nullptr);
+    BOOST_CHECK_EQUAL(cache2.GetCacheSize(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_prefetch_from_disk, TestChain100Setup)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindex = chainActive[50];
+    CCoinsViewCache cache(pcoinsTip);
+    CCoinsPrefetcher prefetcher(2);
+    prefetcher.Start(pindex->GetBlockHash(), pindex->GetBlockPos(), Params().GetConsensus(), pcoinsdbview);
+    std::shared_ptr<const CBlock> pblock = prefetcher.Finish(pindex->GetBlockHash(), cache);
+    BOOST_CHECK(pblock && pblock->GetHash() == pindex->GetBlockHash());
+
+    // A block that is not at the position is dropped
+    prefetcher.Start(pindex->GetBlockHash(), chainActive[51]->GetBlockPos(), Params().GetConsensus(), pcoinsdbview);
+    BOOST_CHECK(prefetcher.Finish(pindex->GetBlockHash(), cache) == nullptr);
 }
 
 // Store of all necessary tx and undo data for next test
@@ -586,7 +713,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
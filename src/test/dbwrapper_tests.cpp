@@ -92,7 +92,7 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
         uint256 in2 = InsecureRand256();
         BOOST_CHECK(dbw.Write(key2, in2));
 
-        std::unique_ptr<CDBIterator> it(const_cast<CDBWrapper&>(dbw).NewIterator());
+        std::unique_ptr<CDBIterator> it(dbw.NewIterator());
 
         // Be sure to seek past the obfuscation key (if it exists)
         it->Seek(key);
@@ -117,6 +117,69 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profile_parse)
+{
+    std::string strError;
+    CDBProfile profile;
+    BOOST_CHECK(ParseDBProfile("large", profile, strError));
+    BOOST_CHECK_EQUAL(profile.nMaxFileSize, 32U << 20);
+    BOOST_CHECK_EQUAL(profile.nMaxOpenFiles, 256);
+
+    // Settings apply in order
+    BOOST_CHECK(ParseDBProfile("maxfilesize=8,default,maxopenfiles=128,bloombits=0,directread=1", profile, strError));
+    BOOST_CHECK_EQUAL(profile.nMaxFileSize, 2U << 20);
+    BOOST_CHECK_EQUAL(profile.nMaxOpenFiles, 128);
+    BOOST_CHECK_EQUAL(profile.nBloomBits, 0);
+    BOOST_CHECK(profile.fDirectRead);
+
+    BOOST_CHECK(!ParseDBProfile("huge", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("maxfilesize=0", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("maxopenfiles=-1", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("maxopenfiles=lots", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("cache=1", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("compression=1", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("", profile, strError));
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_profile)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    create_directories(ph);
+
+    std::string strError;
+    CDBProfile profile;
+    BOOST_CHECK(ParseDBProfile("large,maxfilesize=1,directread=1", profile, strError));
+
+    // Write enough to fill more than one table file
+    std::vector<uint256> values;
+    {
+        CDBWrapper dbw(ph, (1 << 20), false, false, true, profile);
+        for (int i = 0; i < 20000; i++) {
+            values.push_back(InsecureRand256());
+            BOOST_CHECK(dbw.Write(std::make_pair('p', i), values.back()));
+        }
+    }
+
+    // Reopen with the default profile; the data should read back either way
+    for (bool fDefault : {true, false}) {
+        CDBWrapper dbw(ph, (1 << 20), false, false, true, fDefault ? CDBProfile() : profile);
+        uint256 res;
+        BOOST_CHECK(dbw.Read(std::make_pair('p', 1234), res));
+        BOOST_CHECK(res == values[1234]);
+
+        std::unique_ptr<CDBIterator> it(dbw.NewIterator());
+        int n = 0;
+        for (it->Seek(std::make_pair('p', 0)); it->Valid(); it->Next()) {
+            std::pair<char, int> key;
+            BOOST_REQUIRE(it->GetKey(key) && key.first == 'p');
+            BOOST_CHECK(it->GetValue(res));
+            BOOST_CHECK(res == values[key.second]);
+            n++;
+        }
+        BOOST_CHECK_EQUAL(n, 20000);
+    }
+}
+
 // Test that we do not obfuscation if there is existing data.
 BOOST_AUTO_TEST_CASE(existing_data_no_obfuscate)
 {
@@ -0,0 +1,159 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "consensus/validation.h"
+#include "fs.h"
+#include "key.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mempool_persist_tests, TestChain100Setup)
+
+static void ClearMempool()
+{
+    LOCK(mempool.cs);
+    mempool.clear();
+    mempool.mapDeltas.clear();
+}
+
+static CAmount GetModifiedFee(const uint256& hash)
+{
+    LOCK(mempool.cs);
+    CTxMemPool::txiter it = mempool.mapTx.find(hash);
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    return it->GetModifiedFee();
+}
+
+static uint64_t GetCountWithAncestors(const uint256& hash)
+{
+    LOCK(mempool.cs);
+    CTxMemPool::txiter it = mempool.mapTx.find(hash);
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    return it->GetCountWithAncestors();
+}
+
+BOOST_AUTO_TEST_CASE(mempool_persist_reload)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+    // Let the coinbases spent below mature
+    for (int i = 0; i < 4; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+
+    // A parent and its child and a prioritised transaction, and added without
+    // validation, one with a bad signature, one with a wrong fee and one
+    // spending a coin that doesn't exist
+    CMutableTransaction parent = CreateSignedSpend(coinbaseTxns[0], 40*CENT, coinbaseKey, scriptPubKey);
+    CMutableTransaction child = CreateSignedSpend(parent, 30*CENT, coinbaseKey, scriptPubKey);
+    CMutableTransaction prioritised = CreateSignedSpend(coinbaseTxns[1], 40*CENT, coinbaseKey, scriptPubKey);
+    CMutableTransaction bad = CreateSignedSpend(coinbaseTxns[2], 40*CENT, keyWrong, scriptPubKey);
+    CMutableTransaction wrongFee = CreateSignedSpend(coinbaseTxns[3], 40*CENT, coinbaseKey, scriptPubKey);
+    CMutableTransaction missingInput = CreateSignedSpend(wrongFee, 30*CENT, coinbaseKey, scriptPubKey);
+    missingInput.vin[0].prevout.n = 1;
+    const uint256 hashAbsent = uint256S("0x01");
+    {
+        LOCK(cs_main);
+        for (const CMutableTransaction& tx : {parent, child, prioritised}) {
+            CValidationState state;
+            BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, nullptr));
+        }
+        LOCK(mempool.cs);
+        TestMemPoolEntryHelper entry;
+        entry.Time(GetTime()).SpendsCoinbase(true);
+        BOOST_CHECK(CheckSequenceLocks(bad, STANDARD_LOCKTIME_VERIFY_FLAGS, &entry.lp));
+        mempool.addUnchecked(bad.GetHash(), entry.Fee(coinbaseTxns[2].vout[0].nValue - 40*CENT).FromTx(bad));
+        BOOST_CHECK(CheckSequenceLocks(wrongFee, STANDARD_LOCKTIME_VERIFY_FLAGS, &entry.lp));
+        mempool.addUnchecked(wrongFee.GetHash(), entry.Fee(10*CENT).FromTx(wrongFee));
+        mempool.addUnchecked(missingInput.GetHash(), entry.Fee(10*CENT).SpendsCoinbase(false).FromTx(missingInput));
+    }
+    mempool.PrioritiseTransaction(prioritised.GetHash(), 5*CENT);
+    mempool.PrioritiseTransaction(hashAbsent, 7*CENT);
+    const CAmount nFeeChild = GetModifiedFee(child.GetHash());
+    const CAmount nFeePrioritised = GetModifiedFee(prioritised.GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 6);
+
+    // Trusted and still at the tip it was written at: only the scripts are
+    // not checked again
+    gArgs.ForceSetArg("-persistmempooltrusted", "1");
+    DumpMempool();
+    ClearMempool();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 4);
+    BOOST_CHECK(mempool.exists(bad.GetHash()));
+    BOOST_CHECK(!mempool.exists(wrongFee.GetHash()));
+    BOOST_CHECK(!mempool.exists(missingInput.GetHash()));
+    BOOST_CHECK_EQUAL(GetCountWithAncestors(child.GetHash()), 2);
+    BOOST_CHECK_EQUAL(GetModifiedFee(child.GetHash()), nFeeChild);
+    BOOST_CHECK_EQUAL(GetModifiedFee(prioritised.GetHash()), nFeePrioritised);
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent], 7*CENT);
+    }
+
+    // By default everything is validated again, which the transaction with
+    // the bad signature doesn't pass
+    gArgs.ForceSetArg("-persistmempooltrusted", std::to_string(DEFAULT_PERSIST_MEMPOOL_TRUSTED));
+    DumpMempool();
+    ClearMempool();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    BOOST_CHECK(!mempool.exists(bad.GetHash()));
+
+    // And so is everything after a new block, whether trusted or not
+    gArgs.ForceSetArg("-persistmempooltrusted", "1");
+    {
+        LOCK2(cs_main, mempool.cs);
+        TestMemPoolEntryHelper entry;
+        BOOST_CHECK(CheckSequenceLocks(bad, STANDARD_LOCKTIME_VERIFY_FLAGS, &entry.lp));
+        mempool.addUnchecked(bad.GetHash(), entry.Fee(coinbaseTxns[2].vout[0].nValue - 40*CENT).Time(GetTime()).SpendsCoinbase(true).FromTx(bad));
+    }
+    DumpMempool();
+    ClearMempool();
+    CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(LoadMempool());
+    gArgs.ForceSetArg("-persistmempooltrusted", std::to_string(DEFAULT_PERSIST_MEMPOOL_TRUSTED));
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    BOOST_CHECK(!mempool.exists(bad.GetHash()));
+    BOOST_CHECK_EQUAL(GetCountWithAncestors(child.GetHash()), 2);
+    BOOST_CHECK_EQUAL(GetModifiedFee(child.GetHash()), nFeeChild);
+    BOOST_CHECK_EQUAL(GetModifiedFee(prioritised.GetHash()), nFeePrioritised);
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent], 7*CENT);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mempool_persist_truncated)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 2; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < 2; i++) {
+            CValidationState state;
+            CMutableTransaction tx = CreateSignedSpend(coinbaseTxns[i], 40*CENT, coinbaseKey, scriptPubKey);
+            BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, nullptr));
+        }
+    }
+    DumpMempool();
+    ClearMempool();
+
+    // Cut off in the fee deltas at the end, which are read while the chunk
+    // of entries before them is still being deserialized
+    fs::path path = GetDataDir() / "mempool.dat";
+    fs::resize_file(path, fs::file_size(path) - 1);
+    BOOST_CHECK(!LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
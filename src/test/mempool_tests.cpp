@@ -543,7 +543,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
         pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 5); // should maximize mempool size by only removing 5/7
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(pool.exists(tx6.GetHash()));
@@ -581,4 +581,72 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 10 * COIN;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txChild.vin[i].prevout = COutPoint(txParent.GetHash(), i);
+        txChild.vin[i].scriptSig = CScript() << OP_11;
+    }
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 19 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).Time(1).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).Time(2).FromTx(txChild));
+
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2);
+    const CTxMemPoolSnapshot::Entry* parent = snapshot->find(txParent.GetHash());
+    const CTxMemPoolSnapshot::Entry* child = snapshot->find(txChild.GetHash());
+    BOOST_REQUIRE(parent && child);
+    BOOST_CHECK(parent->vParents.empty());
+    BOOST_CHECK_EQUAL(parent->nCountWithDescendants, 2);
+    BOOST_CHECK_EQUAL(parent->nModFeesWithDescendants, 3000);
+    BOOST_CHECK_EQUAL(child->nFee, 2000);
+    BOOST_CHECK_EQUAL(child->nTime, 2);
+    BOOST_CHECK_EQUAL(child->nCountWithAncestors, 2);
+    BOOST_REQUIRE_EQUAL(child->vParents.size(), 1);
+    BOOST_CHECK(child->vParents[0] == txParent.GetHash());
+    BOOST_CHECK(!snapshot->find(uint256()));
+
+    // Shared until the pool changes
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+    pool.PrioritiseTransaction(txChild.GetHash(), 500);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshotPrioritised = pool.GetSnapshot();
+    BOOST_CHECK(snapshotPrioritised != snapshot);
+    BOOST_CHECK_EQUAL(snapshotPrioritised->find(txChild.GetHash())->nModifiedFee, 2500);
+
+    // Readers keep their view while the pool changes underneath
+    pool.removeRecursive(txParent);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2);
+    BOOST_CHECK_EQUAL(snapshot->find(txChild.GetHash())->nModifiedFee, 2000);
+    BOOST_CHECK(pool.GetSnapshot()->vEntries.empty());
+
+    // A snapshot of selected entries only
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.FromTx(txChild));
+    {
+        LOCK(pool.cs);
+        snapshot = pool.GetSnapshot(CTxMemPool::setEntries{pool.mapTx.find(txChild.GetHash())});
+    }
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 1);
+    BOOST_CHECK(snapshot->vEntries[0].tx->GetHash() == txChild.GetHash());
+    BOOST_REQUIRE_EQUAL(snapshot->vEntries[0].vParents.size(), 1);
+    BOOST_CHECK(snapshot->vEntries[0].vParents[0] == txParent.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,10 +8,13 @@
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "key.h"
 #include "validation.h"
 #include "miner.h"
 #include "policy/policy.h"
+#include "pow.h"
 #include "pubkey.h"
+#include "script/sign.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -505,4 +508,142 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static std::set<uint256> TemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::set<uint256> txids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); i++)
+        txids.insert(blocktemplate.block.vtx[i]->GetHash());
+    return txids;
+}
+
+static bool ToMemPool(const CMutableTransaction& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, nullptr, nullptr, true, 0);
+}
+
+static void CheckTemplate(const CChainParams& chainparams, const CBlockTemplate& blocktemplate, const CScript& scriptPubKey)
+{
+    LOCK(cs_main);
+    const CBlock& block = blocktemplate.block;
+    BOOST_CHECK(block.vtx[0]->vout[0].scriptPubKey == scriptPubKey);
+    BOOST_CHECK_EQUAL(block.vtx[0]->vout[0].nValue, -blocktemplate.vTxFees[0] + GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus()));
+    // Same transactions as a template assembled from scratch
+    BOOST_CHECK(TemplateTxids(blocktemplate) == TemplateTxids(*BlockAssembler(chainparams).CreateNewBlock(scriptPubKey)));
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, chainparams, block, chainActive.Tip(), false, false));
+}
+
+BOOST_FIXTURE_TEST_CASE(IncrementalBlockTemplate, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    CBlockTemplateCache cache;
+
+    // Mature three more coinbases to spend
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 3; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptCoinbase);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.Get(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // New transactions are added to the cached template
+    std::vector<CMutableTransaction> spends;
+    for (int i = 0; i < 3; i++) {
+        spends.push_back(CreateSignedSpend(coinbaseTxns[i], coinbaseTxns[i].vout[0].nValue - (i + 1) * CENT, coinbaseKey, scriptCoinbase));
+        BOOST_CHECK(ToMemPool(spends.back()));
+    }
+    pblocktemplate = cache.Get(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    CheckTemplate(chainparams, *pblocktemplate, scriptPubKey);
+
+    // ... including children of transactions already in it
+    CMutableTransaction child = CreateSignedSpend(spends[0], spends[0].vout[0].nValue - COIN, coinbaseKey, scriptCoinbase);
+    BOOST_CHECK(ToMemPool(child));
+    pblocktemplate = cache.Get(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 5);
+    BOOST_CHECK(pblocktemplate->block.vtx.back()->GetHash() == child.GetHash());
+    CheckTemplate(chainparams, *pblocktemplate, scriptPubKey);
+
+    // An update that fails TestBlockValidity isn't handed out
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+    CMutableTransaction bad = CreateSignedSpend(coinbaseTxns[3], coinbaseTxns[3].vout[0].nValue - CENT, keyWrong, scriptCoinbase);
+    {
+        LOCK(mempool.cs);
+        TestMemPoolEntryHelper entry;
+        mempool.addUnchecked(bad.GetHash(), entry.Fee(CENT).Time(GetTime()).SpendsCoinbase(true).FromTx(bad));
+    }
+    BOOST_CHECK(!BlockAssembler(chainparams).UpdateNewBlock(*pblocktemplate, {bad.GetHash()}));
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(CTransaction(bad));
+    }
+
+    // Removing a template transaction forces a rebuild
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(CTransaction(spends[0]), MemPoolRemovalReason::CONFLICT);
+    }
+    pblocktemplate = cache.Get(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    CheckTemplate(chainparams, *pblocktemplate, scriptPubKey);
+
+    // So does a new tip
+    CreateAndProcessBlock(spends, scriptPubKey);
+    pblocktemplate = cache.Get(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(yespower_scanner)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = InsecureRand256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = 1516252661;
+    header.nBits = 0x1e0ffff0;
+
+    CYespowerScanner scanner;
+    scanner.SetHeader(header);
+    for (uint32_t nNonce = 0xfffffffe; nNonce != 2; nNonce++) {
+        uint256 hash;
+        scanner.Hash(nNonce, hash);
+        header.nNonce = nNonce;
+        BOOST_CHECK(hash == header.GetHashYespower());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(header_solver)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = chainParams->GetConsensus();
+
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = InsecureRand256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = 1516252661;
+    header.nBits = 0x200fffff;
+    header.nNonce = 3;
+
+    // The lowest solution, as found by a serial search
+    CBlockHeader serial = header;
+    while (!CheckProofOfWork(serial.GetHashYespower(), serial.nBits, params))
+        serial.nNonce++;
+
+    CHeaderSolver solver(3);
+    CBlockHeader solved = header;
+    BOOST_CHECK(solver.Solve(solved, serial.nNonce + 100, params));
+    BOOST_CHECK_EQUAL(solved.nNonce, serial.nNonce);
+
+    // Nothing below it
+    solved = header;
+    BOOST_CHECK(!solver.Solve(solved, serial.nNonce, params));
+    BOOST_CHECK_EQUAL(solved.nNonce, serial.nNonce);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
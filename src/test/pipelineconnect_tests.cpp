@@ -0,0 +1,129 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "miner.h"
+#include "pow.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pipelineconnect_tests, TestChain100Setup)
+
+/** Create a chain of blocks on top of the tip, each with one of txns, without processing them */
+static std::vector<std::shared_ptr<const CBlock> > CreateBlocks(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
+{
+    const CChainParams& chainparams = Params();
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    CBlock block = pblocktemplate->block;
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = chainActive.Height();
+
+    std::vector<std::shared_ptr<const CBlock> > vBlocks;
+    for (const CMutableTransaction& tx : txns) {
+        block.vtx.resize(1);
+        block.vtx.push_back(MakeTransactionRef(tx));
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(&block, &indexPrev, extraNonce);
+        while (!CheckProofOfWork(block.GetHashYespower(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+        vBlocks.push_back(std::make_shared<const CBlock>(block));
+
+        block.hashPrevBlock = block.GetHash();
+        block.nTime++;
+        block.nNonce = 0;
+        indexPrev.nHeight++;
+    }
+    return vBlocks;
+}
+
+/** Announce the headers of vBlocks, then process the blocks last to first, so they are all connected at once */
+static void ProcessBlocksReversed(const std::vector<std::shared_ptr<const CBlock> >& vBlocks)
+{
+    std::vector<CBlockHeader> vHeaders;
+    for (const std::shared_ptr<const CBlock>& pblock : vBlocks)
+        vHeaders.push_back(pblock->GetBlockHeader());
+    CValidationState state;
+    BOOST_REQUIRE(ProcessNewBlockHeaders(vHeaders, state, Params()));
+    for (auto it = vBlocks.rbegin(); it != vBlocks.rend(); ++it)
+        ProcessNewBlock(Params(), *it, true, nullptr);
+}
+
+static const CBlockIndex* LookupIndex(const CBlock& block)
+{
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(block.GetHash());
+    BOOST_REQUIRE(it != mapBlockIndex.end());
+    return it->second;
+}
+
+BOOST_AUTO_TEST_CASE(pipelineconnect_valid)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> txns;
+    for (int i = 0; i < 6; i++)
+        txns.push_back(CreateSignedSpend(coinbaseTxns[i], 11*CENT, coinbaseKey, scriptPubKey));
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = CreateBlocks(txns, scriptPubKey);
+    ProcessBlocksReversed(vBlocks);
+
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks.back()->GetHash());
+    for (size_t i = 0; i < txns.size(); i++) {
+        BOOST_CHECK(LookupIndex(*vBlocks[i])->IsValid(BLOCK_VALID_SCRIPTS));
+        BOOST_CHECK(LookupIndex(*vBlocks[i])->nStatus & BLOCK_HAVE_UNDO);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(txns[i].vin[0].prevout));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txns[i].GetHash(), 0)));
+    }
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == vBlocks.back()->GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(pipelineconnect_bad_script)
+{
+    // The script checks of the second block fail while the third one is
+    // already applied on top of it
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(CreateSignedSpend(coinbaseTxns[0], 11*CENT, coinbaseKey, scriptPubKey));
+    txns.push_back(CreateSignedSpend(coinbaseTxns[1], 11*CENT, keyWrong, scriptPubKey));
+    txns.push_back(CreateSignedSpend(coinbaseTxns[2], 11*CENT, coinbaseKey, scriptPubKey));
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = CreateBlocks(txns, scriptPubKey);
+    ProcessBlocksReversed(vBlocks);
+
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks[0]->GetHash());
+    BOOST_CHECK(LookupIndex(*vBlocks[1])->nStatus & BLOCK_FAILED_VALID);
+    BOOST_CHECK(!chainActive.Contains(LookupIndex(*vBlocks[2])));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(txns[0].vin[0].prevout));
+    BOOST_CHECK(pcoinsTip->HaveCoin(txns[1].vin[0].prevout));
+    BOOST_CHECK(pcoinsTip->HaveCoin(txns[2].vin[0].prevout));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(txns[2].GetHash(), 0)));
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == vBlocks[0]->GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(pipelineconnect_double_spend)
+{
+    // The second block spends a coin spent by the first one, which is only
+    // seen as spent in the view of the first block while its checks run
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(CreateSignedSpend(coinbaseTxns[0], 11*CENT, coinbaseKey, scriptPubKey));
+    txns.push_back(CreateSignedSpend(coinbaseTxns[0], 11*CENT, coinbaseKey, CScript() << OP_TRUE));
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = CreateBlocks(txns, scriptPubKey);
+    ProcessBlocksReversed(vBlocks);
+
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks[0]->GetHash());
+    BOOST_CHECK(LookupIndex(*vBlocks[1])->nStatus & BLOCK_FAILED_VALID);
+    BOOST_CHECK(!pcoinsTip->HaveCoin(txns[0].vin[0].prevout));
+    BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txns[0].GetHash(), 0)));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(txns[1].GetHash(), 0)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
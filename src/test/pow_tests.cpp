@@ -4,12 +4,18 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "checkqueue.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
 #include "pow.h"
 #include "random.h"
+#include "streams.h"
 #include "util.h"
+#include "validation.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
 
@@ -86,4 +92,199 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(diskblockindex_pow_hash)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1516252661;
+    header.nBits = 0x207fffff;
+    header.nNonce = 42;
+
+    CBlockIndex index(header);
+    index.nStatus = BLOCK_VALID_TREE;
+    uint256 hash = header.GetHash();
+    index.phashBlock = &hash;
+
+    // Without the flag the PoW hash is not stored
+    CDataStream ssPlain(SER_DISK, CLIENT_VERSION);
+    ssPlain << CDiskBlockIndex(&index);
+    CDiskBlockIndex plain;
+    ssPlain >> plain;
+    BOOST_CHECK(ssPlain.empty());
+    BOOST_CHECK(plain.hashPoW.IsNull());
+
+    index.hashPoW = header.GetHashYespower();
+    index.nStatus |= BLOCK_HAVE_POW_HASH;
+    CDataStream ssPoW(SER_DISK, CLIENT_VERSION);
+    ssPoW << CDiskBlockIndex(&index);
+    CDiskBlockIndex withPoW;
+    ssPoW >> withPoW;
+    BOOST_CHECK(ssPoW.empty());
+    BOOST_CHECK(withPoW.nStatus & BLOCK_HAVE_POW_HASH);
+    BOOST_CHECK(withPoW.hashPoW == index.hashPoW);
+    BOOST_CHECK(withPoW.GetBlockHash() == hash);
+}
+
+/* DarkGravityWave as originally written, with arith_uint256 division throughout */
+static unsigned int ReferenceDarkGravityWave(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    const CBlockIndex* pBlockReading = pindexLast;
+    int64_t nActualTimespan = 0;
+    int64_t nLastBlockTime = 0;
+    int64_t nCountBlocks = 0;
+    arith_uint256 bnPastDifficultyAverage;
+    arith_uint256 bnPastDifficultyAveragePrev;
+
+    for (unsigned int i = 1; pBlockReading && pBlockReading->nHeight > 0 && i <= 12; i++) {
+        nCountBlocks++;
+        if (nCountBlocks <= 10) {
+            if (nCountBlocks == 1) {
+                bnPastDifficultyAverage.SetCompact(pBlockReading->nBits);
+            } else {
+                bnPastDifficultyAverage = ((bnPastDifficultyAveragePrev * nCountBlocks) + (arith_uint256().SetCompact(pBlockReading->nBits))) / (nCountBlocks + 1);
+            }
+            bnPastDifficultyAveragePrev = bnPastDifficultyAverage;
+        }
+        if (nLastBlockTime > 0)
+            nActualTimespan += nLastBlockTime - pBlockReading->GetBlockTime();
+        nLastBlockTime = pBlockReading->GetBlockTime();
+        pBlockReading = pBlockReading->pprev;
+    }
+
+    arith_uint256 bnNew(bnPastDifficultyAverage);
+    int64_t nTargetTimespan = nCountBlocks * params.nPowTargetSpacing;
+    nActualTimespan = std::max(nActualTimespan, nTargetTimespan / 3);
+    nActualTimespan = std::min(nActualTimespan, nTargetTimespan * 3);
+    bnNew *= nActualTimespan;
+    bnNew /= nTargetTimespan;
+    if (bnNew > UintToArith256(params.powLimit))
+        bnNew = UintToArith256(params.powLimit);
+    return bnNew.GetCompact();
+}
+
+BOOST_AUTO_TEST_CASE(dark_gravity_wave)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+
+    std::vector<CBlockIndex> blocks(1000);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = i ? blocks[i - 1].nTime + InsecureRandRange(600) : 1516252661;
+        if (i < 100 || InsecureRandBits(3) == 0) {
+            blocks[i].nBits = UintToArith256(params.powLimit).GetCompact();
+        } else {
+            // Mostly follow the retarget, with an occasional odd block for coverage
+            blocks[i].nBits = GetNextWorkRequired(&blocks[i - 1], nullptr, params);
+            if (InsecureRandBits(4) == 0)
+                blocks[i].nBits = 0x1c000000 | (InsecureRand32() & 0x007fffff);
+        }
+    }
+
+    for (size_t i = 100; i < blocks.size(); i++) {
+        const unsigned int nBits = GetNextWorkRequired(&blocks[i], nullptr, params);
+        BOOST_CHECK_EQUAL(nBits, ReferenceDarkGravityWave(&blocks[i], params));
+        BOOST_CHECK_EQUAL(blocks[i].nNextWorkRequired, nBits);
+        // Served from the block index the second time
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[i], nullptr, params), nBits);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pow_check_queue)
+{
+    std::vector<CBlockHeader> headers(20);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 4;
+        headers[i].nTime = 1516252661 + i;
+        headers[i].nBits = 0x207fffff;
+        headers[i].nNonce = InsecureRand32();
+    }
+
+    CCheckQueue<CPoWCheck> queue(2);
+    boost::thread_group tg;
+    for (int i = 0; i < 3; i++) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+
+    std::vector<uint256> vHashPoW(headers.size());
+    {
+        CCheckQueueControl<CPoWCheck> control(&queue);
+        std::vector<CPoWCheck> vChecks;
+        for (size_t i = 0; i < headers.size(); i++) {
+            vChecks.emplace_back(headers[i], &vHashPoW[i]);
+        }
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+
+    for (size_t i = 0; i < headers.size(); i++) {
+        BOOST_CHECK(vHashPoW[i] == headers[i].GetHashYespower());
+    }
+}
+
+/* Header on top of pprevHeader, or on pindexPrev if null. Regtest does not
+ * retarget, so pindexPrev gives the right nBits either way. */
+static CBlockHeader MineHeader(const CBlockIndex* pindexPrev, const CBlockHeader* pprevHeader, const Consensus::Params& params)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = pprevHeader ? pprevHeader->GetHash() : pindexPrev->GetBlockHash();
+    header.nTime = pprevHeader ? pprevHeader->nTime + 1 : pindexPrev->GetMedianTimePast() + 1;
+    header.nBits = GetNextWorkRequired(pindexPrev, &header, params);
+    while (!CheckProofOfWork(header.GetHashYespower(), header.nBits, params))
+        header.nNonce++;
+    return header;
+}
+
+BOOST_FIXTURE_TEST_CASE(headers_prefilter, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& params = chainparams.GetConsensus();
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+
+    // Valid headers raise the PoW budget as they are accepted
+    std::vector<CBlockHeader> headers;
+    for (int i = 0; i < 3; i++)
+        headers.push_back(MineHeader(pindexTip, headers.empty() ? nullptr : &headers.back(), params));
+    unsigned int nPoWBudget = 1;
+    CValidationState state;
+    const CBlockIndex* pindexLast = nullptr;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, nullptr, &nPoWBudget));
+    BOOST_CHECK(pindexLast && pindexLast->GetBlockHash() == headers.back().GetHash());
+    BOOST_CHECK_EQUAL(nPoWBudget, 4);
+
+    // Headers failing the cheap checks are rejected for that reason, before
+    // their (missing) proof of work is looked at
+    CBlockHeader bogus = headers.back();
+    bogus.hashPrevBlock = headers.back().GetHash();
+    bogus.nTime++;
+    bogus.nBits = 0x1d00ffff;
+    bogus.nNonce = 0;
+    CBlockHeader first_invalid;
+    BOOST_CHECK(!ProcessNewBlockHeaders({bogus}, state, chainparams, nullptr, &first_invalid, &nPoWBudget));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-diffbits");
+    BOOST_CHECK(first_invalid.GetHash() == bogus.GetHash());
+    BOOST_CHECK_EQUAL(nPoWBudget, 1);
+
+    bogus.hashPrevBlock = InsecureRand256();
+    state = CValidationState();
+    BOOST_CHECK(!ProcessNewBlockHeaders({bogus}, state, chainparams, nullptr, nullptr, &nPoWBudget));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "prev-blk-not-found");
+
+    // Only a header passing them gets to the proof of work
+    bogus = MineHeader(pindexLast, nullptr, params);
+    while (CheckProofOfWork(bogus.GetHashYespower(), bogus.nBits, params))
+        bogus.nNonce++;
+    state = CValidationState();
+    BOOST_CHECK(!ProcessNewBlockHeaders({bogus}, state, chainparams, nullptr, nullptr, &nPoWBudget));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
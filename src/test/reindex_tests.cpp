@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
+#include "streams.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(reindex_tests, TestChain100Setup)
+
+/** Rewrite blk00000.dat with the given blocks, each preceded by some junk */
+static void WriteBlockFile(const std::vector<CBlock>& vBlocks, const std::vector<size_t>& vOrder)
+{
+    CAutoFile file(fsbridge::fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk"), "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    for (size_t i : vOrder) {
+        // A stray message start and a bogus size must be skipped
+        file << FLATDATA(Params().MessageStart()) << (unsigned int)(MAX_BLOCK_SERIALIZED_SIZE + 1);
+        file << FLATDATA(Params().MessageStart()) << (unsigned int)GetSerializeSize(file, vBlocks[i]) << vBlocks[i];
+    }
+    // A truncated block at the end
+    file << FLATDATA(Params().MessageStart()) << (unsigned int)1000 << uint256();
+}
+
+BOOST_AUTO_TEST_CASE(reindex_block_file_reader)
+{
+    std::vector<CBlock> vBlocks;
+    for (const CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex)) {
+        vBlocks.emplace_back();
+        BOOST_REQUIRE(ReadBlockFromDisk(vBlocks.back(), pindex, Params().GetConsensus()));
+    }
+    std::vector<size_t> vOrder;
+    for (size_t i = 0; i < vBlocks.size(); i++)
+        vOrder.push_back(i);
+    UnloadBlockIndex(); // Drops the mapped block files
+    WriteBlockFile(vBlocks, vOrder);
+
+    // Read ahead less than a block at a time, in batches of 3
+    CBlockFileReader reader(Params().MessageStart(), 0, 1);
+    std::vector<CBlockFileReader::Entry> vEntries;
+    size_t nRead = 0;
+    while (reader.Read(vEntries, 3)) {
+        BOOST_CHECK(vEntries.size() <= 3);
+        for (const CBlockFileReader::Entry& entry : vEntries) {
+            BOOST_REQUIRE(nRead < vBlocks.size());
+            BOOST_CHECK_EQUAL(entry.pos.nFile, 0);
+            CBlock block;
+            CDataStream(entry.vchBlock, SER_DISK, CLIENT_VERSION) >> block;
+            BOOST_CHECK(block.GetHash() == vBlocks[nRead].GetHash());
+            nRead++;
+        }
+    }
+    BOOST_CHECK_EQUAL(nRead, vBlocks.size());
+    BOOST_CHECK(reader.GetError().empty());
+}
+
+BOOST_AUTO_TEST_CASE(reindex_block_files)
+{
+    const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    std::vector<CBlock> vBlocks;
+    for (const CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex)) {
+        vBlocks.emplace_back();
+        BOOST_REQUIRE(ReadBlockFromDisk(vBlocks.back(), pindex, Params().GetConsensus()));
+    }
+
+    // Store the blocks after the genesis block in swapped pairs, so half of
+    // them come before their parent
+    std::vector<size_t> vOrder = {0};
+    for (size_t i = 1; i + 1 < vBlocks.size(); i += 2) {
+        vOrder.push_back(i + 1);
+        vOrder.push_back(i);
+    }
+    if (vOrder.size() < vBlocks.size())
+        vOrder.push_back(vBlocks.size() - 1);
+
+    // Start over from an empty block index and chainstate, as -reindex does
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    WriteBlockFile(vBlocks, vOrder);
+
+    BOOST_CHECK(ReindexBlockFiles(Params()));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), vBlocks.size());
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    // The yespower hashes from the import check threads were kept, also for
+    // the blocks that had to wait for their parent
+    for (const CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex))
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_POW_HASH);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "consensus/merkle.h"
+#include "streams.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, BasicTestingSetup)
+
+static CBlock BuildBlock()
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = uint256S("0x0000a1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e");
+    block.nTime = 1516252661;
+    block.nBits = 0x1e0ffff0;
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << 1234 << OP_0;
+    txCoinbase.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txCoinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(MakeTransactionRef(std::move(txCoinbase)));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = COIN;
+        tx.nLockTime = i;
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(stratum_job_coinbase_split)
+{
+    const CStratumJob job(BuildBlock(), 1234);
+    const std::vector<unsigned char> vchExtraNonce = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    const CBlock block = job.GetBlock(vchExtraNonce, 1516252700, 0xdeadbeef);
+    BOOST_CHECK(block.vtx[0]->vin[0].scriptSig == (CScript() << 1234 << vchExtraNonce) + COINBASE_FLAGS);
+    BOOST_CHECK(block.vtx[0]->vin[0].scriptWitness.stack == job.block.vtx[0]->vin[0].scriptWitness.stack);
+    BOOST_CHECK_EQUAL(block.vtx.size(), job.block.vtx.size());
+
+    // The coinbase handed to miners is the transaction without its witness
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss << *block.vtx[0];
+    const std::vector<unsigned char> vchCoinbase = job.GetCoinbase(vchExtraNonce);
+    BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchCoinbase);
+
+    // A share header commits to the same block that is submitted for it
+    const CBlockHeader header = job.GetHeader(vchExtraNonce, 1516252700, 0xdeadbeef);
+    BOOST_CHECK(header.hashMerkleRoot == BlockMerkleRoot(block));
+    BOOST_CHECK(header.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(header.nTime, 1516252700U);
+    BOOST_CHECK_EQUAL(header.nNonce, 0xdeadbeefU);
+
+    const std::vector<unsigned char> vchOtherExtraNonce = {1, 2, 3, 4, 0, 0, 0, 1};
+    BOOST_CHECK(job.GetHeader(vchOtherExtraNonce, 1516252700, 0xdeadbeef).hashMerkleRoot != header.hashMerkleRoot);
+}
+
+BOOST_AUTO_TEST_CASE(stratum_share_target)
+{
+    const arith_uint256 diff1 = UintToArith256(uint256S("0x00000000ffff0000000000000000000000000000000000000000000000000000"));
+    arith_uint256 target;
+    BOOST_CHECK(GetStratumShareTarget(1, target));
+    BOOST_CHECK(target == diff1);
+    BOOST_CHECK(GetStratumShareTarget(16, target));
+    BOOST_CHECK(target == diff1 >> 4);
+    BOOST_CHECK(GetStratumShareTarget(1.0 / 65536, target));
+    BOOST_CHECK(target == diff1 << 16);
+    BOOST_CHECK(GetStratumShareTarget(3, target));
+    BOOST_CHECK(target <= diff1 / 3 && target + 1024 > diff1 / 3);
+
+    BOOST_CHECK(!GetStratumShareTarget(0, target));
+    BOOST_CHECK(!GetStratumShareTarget(-1, target));
+    BOOST_CHECK(!GetStratumShareTarget(1.0 / (65536.0 * 65536.0 * 65536.0), target));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
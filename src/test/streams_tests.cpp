@@ -71,6 +71,32 @@ BOOST_AUTO_TEST_CASE(streams_vector_writer)
     vch.clear();
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    std::vector<unsigned char> vch = {1, 255, 3, 4, 5, 6};
+    CSpanReader reader(SER_NETWORK, INIT_PROTO_VERSION, (const char*)vch.data(), vch.size());
+    BOOST_CHECK_EQUAL(reader.size(), 6);
+    BOOST_CHECK(!reader.empty());
+
+    unsigned char a;
+    reader >> a;
+    BOOST_CHECK_EQUAL(a, 1);
+    uint16_t b;
+    reader >> b;
+    BOOST_CHECK_EQUAL(b, 1023); // little endian
+    BOOST_CHECK_EQUAL(reader.size(), 3);
+
+    // Reading past the end throws and leaves the position alone
+    uint32_t c;
+    BOOST_CHECK_THROW(reader >> c, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(reader.size(), 3);
+    reader.ignore(1);
+    reader >> b;
+    BOOST_CHECK_EQUAL(b, 1541);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> a, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
 {
     std::vector<char> in;
@@ -20,6 +20,7 @@
 #include "ui_interface.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "script/interpreter.h"
 #include "script/sigcache.h"
 
 #include <memory>
@@ -83,6 +84,7 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        StartCoinsPrefetch(2);
         if (!LoadGenesisBlock(chainparams)) {
             throw std::runtime_error("LoadGenesisBlock failed.");
         }
@@ -93,8 +95,13 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             }
         }
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPoWCheck);
+            threadGroup.create_thread(&ThreadImportCheck);
+            threadGroup.create_thread(&ThreadScriptCheckPipelined);
+        }
+        nPipelineConnectBlocks = DEFAULT_PIPELINE_CONNECT_BLOCKS;
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         peerLogic.reset(new PeerLogicValidation(connman, scheduler));
@@ -109,6 +116,7 @@ TestingSetup::~TestingSetup()
         g_connman.reset();
         peerLogic.reset();
         UnloadBlockIndex();
+        StartCoinsPrefetch(0);
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
@@ -156,6 +164,27 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     return result;
 }
 
+CMutableTransaction
+TestChain100Setup::CreateSignedSpend(const CTransaction& txFrom, CAmount nValue, const CKey& key, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    // Sign:
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(txFrom.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    bool fSigned = key.Sign(hash, vchSig);
+    assert(fSigned);
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
 TestChain100Setup::~TestChain100Setup()
 {
 }
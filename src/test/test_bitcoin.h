@@ -57,7 +57,6 @@ struct CConnmanTest {
 
 class PeerLogicValidation;
 struct TestingSetup: public BasicTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     fs::path pathTemp;
     boost::thread_group threadGroup;
     CConnman* connman;
@@ -84,6 +83,11 @@ struct TestChain100Setup : public TestingSetup {
     CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
                                  const CScript& scriptPubKey);
 
+    // Create a transaction spending output 0 of txFrom, which pays to a public
+    // key, signed with key, and paying nValue to scriptPubKey.
+    CMutableTransaction CreateSignedSpend(const CTransaction& txFrom, CAmount nValue,
+                                          const CKey& key, const CScript& scriptPubKey);
+
     ~TestChain100Setup();
 
     std::vector<CTransaction> coinbaseTxns; // For convenience, coinbase transactions
@@ -12,6 +12,7 @@
 #include "script/standard.h"
 #include "script/sign.h"
 #include "test/test_bitcoin.h"
+#include "txacceptqueue.h"
 #include "utiltime.h"
 #include "core_io.h"
 #include "keystore.h"
@@ -90,6 +91,63 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_batch, TestChain100Setup)
+{
+    // Accept transactions collected by a CTxBatchQueue as one batch
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey keyWrong;
+    keyWrong.MakeNewKey(true);
+    // Let the coinbases spent below mature
+    for (int i = 0; i < 11; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+
+    // Spends of the first 10 mature coinbases, a second spend of the first
+    // one, one with a bad signature and a spend of the first transaction
+    std::vector<CMutableTransaction> spends;
+    for (int i = 0; i < 12; i++) {
+        const int nCoinbase = i < 10 ? i : i == 10 ? 0 : 10;
+        spends.push_back(CreateSignedSpend(coinbaseTxns[nCoinbase], (11 + i)*CENT, i != 11 ? coinbaseKey : keyWrong, scriptPubKey));
+    }
+    spends.push_back(CreateSignedSpend(spends[0], 5*CENT, coinbaseKey, scriptPubKey));
+
+    std::vector<std::vector<CTransactionRef> > vBatches;
+    std::vector<CTxAcceptResult> vResults;
+    {
+        CTxAcceptQueue queue(4, spends.size());
+        CTxBatchQueue<CTransactionRef> batchQueue([&](std::vector<CTransactionRef>& vBatch) {
+            vBatches.push_back(vBatch);
+            AcceptToMemoryPoolBatch(mempool, vBatch, vResults, false, &queue);
+        }, 60 * 1000, spends.size(), spends.size());
+        for (const CMutableTransaction& spend : spends)
+            BOOST_CHECK(batchQueue.Add(MakeTransactionRef(spend)));
+        batchQueue.Stop();
+        BOOST_CHECK(!batchQueue.Add(MakeTransactionRef(spends[0])));
+        queue.Stop();
+        BOOST_CHECK(!queue.Add([] {}));
+    }
+
+    // All of them went in one batch, the one filling it up
+    BOOST_REQUIRE_EQUAL(vBatches.size(), 1);
+    BOOST_REQUIRE_EQUAL(vResults.size(), spends.size());
+    for (size_t i = 0; i < 10; i++) {
+        BOOST_CHECK(vResults[i].fAccepted && mempool.exists(spends[i].GetHash()));
+    }
+    // The earlier of the double spends wins
+    BOOST_CHECK(!vResults[10].fAccepted);
+    BOOST_CHECK_EQUAL(vResults[10].state.GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK(!vResults[11].fAccepted);
+    BOOST_CHECK(vResults[11].state.GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+    // The parent was not in the mempool yet when the batch was looked up
+    BOOST_CHECK(!vResults[12].fAccepted && vResults[12].fMissingInputs);
+    BOOST_CHECK_EQUAL(mempool.size(), 10);
+
+    // The child can go in now
+    std::vector<CTxAcceptResult> vResultsChild;
+    AcceptToMemoryPoolBatch(mempool, {MakeTransactionRef(spends[12])}, vResultsChild, false, nullptr);
+    BOOST_CHECK(vResultsChild[0].fAccepted);
+    BOOST_CHECK_EQUAL(mempool.size(), 11);
+}
+
 // Run CheckInputs (using pcoinsTip) on the given transaction, for all script
 // flags.  Test that CheckInputs passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txacceptqueue.h"
+
+#include "util.h"
+
+#include <algorithm>
+
+CTxAcceptQueue::CTxAcceptQueue(int nThreads, size_t nMaxQueuedIn) : nMaxQueued(nMaxQueuedIn), nActive(0), fStopped(false)
+{
+    for (int i = 0; i < std::max(1, nThreads); i++)
+        vThreads.emplace_back(&CTxAcceptQueue::Thread, this);
+}
+
+CTxAcceptQueue::~CTxAcceptQueue()
+{
+    Stop();
+}
+
+void CTxAcceptQueue::Thread()
+{
+    RenameThread("bitcoin-txaccept");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condJob.wait(lock, [&]{ return fStopped || !queue.empty(); });
+            if (queue.empty())
+                return;
+            job = std::move(queue.front());
+            queue.pop_front();
+            nActive++;
+        }
+
+        try {
+            job();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "CTxAcceptQueue::Thread()");
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--nActive == 0 && queue.empty())
+            condIdle.notify_all();
+    }
+}
+
+bool CTxAcceptQueue::Add(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fStopped || queue.size() >= nMaxQueued)
+            return false;
+        queue.push_back(std::move(job));
+    }
+    condJob.notify_one();
+    return true;
+}
+
+void CTxAcceptQueue::Wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condIdle.wait(lock, [&]{ return nActive == 0 && queue.empty(); });
+}
+
+void CTxAcceptQueue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fStopped)
+            return;
+        fStopped = true;
+    }
+    condJob.notify_all();
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
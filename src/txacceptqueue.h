@@ -0,0 +1,157 @@
+// Copyright (c) 2018 The FairCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXACCEPTQUEUE_H
+#define BITCOIN_TXACCEPTQUEUE_H
+
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Runs jobs on a few threads, in no particular order. Used to check the
+ * scripts of a batch of transactions in parallel and without cs_main held
+ * (see AcceptToMemoryPoolBatch).
+ *
+ * The queue is bounded: when it is full, or stopped, Add() refuses the job
+ * and the caller runs it itself.
+ */
+class CTxAcceptQueue
+{
+private:
+    std::vector<std::thread> vThreads;
+    std::mutex mutex;
+    std::condition_variable condJob;
+    std::condition_variable condIdle;
+    std::deque<std::function<void()> > queue;
+    const size_t nMaxQueued;
+    size_t nActive;
+    bool fStopped;
+
+    void Thread();
+
+public:
+    CTxAcceptQueue(int nThreads, size_t nMaxQueuedIn);
+    ~CTxAcceptQueue();
+
+    //! Queue job, unless the queue is full or stopped
+    bool Add(std::function<void()> job);
+    //! Wait until the jobs queued so far have run
+    void Wait();
+    //! Run the jobs still queued and stop the threads; later jobs are refused
+    void Stop();
+};
+
+/**
+ * Collects transactions received from any peer and hands them to fnProcess in
+ * batches, on a thread of its own: once nMaxBatch of them are waiting, or
+ * nWindow milliseconds after the first one came in, whichever is sooner.
+ * Transactions that come in while a batch is processed go to the next one.
+ *
+ * Like CTxAcceptQueue, Add() refuses items once nMaxQueued are waiting or the
+ * queue is stopped, and the caller then handles them itself.
+ */
+template <typename T>
+class CTxBatchQueue
+{
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<T> vQueued;
+    //! When the first of vQueued came in
+    int64_t nFirstQueuedTime;
+    const std::function<void(std::vector<T>&)> fnProcess;
+    const int64_t nWindow;
+    const size_t nMaxBatch;
+    const size_t nMaxQueued;
+    bool fStopped;
+
+    void Thread()
+    {
+        RenameThread("bitcoin-txbatch");
+        while (true) {
+            std::vector<T> vBatch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]{ return fStopped || !vQueued.empty(); });
+                if (vQueued.empty())
+                    return;
+                while (!fStopped && vQueued.size() < nMaxBatch) {
+                    int64_t nWait = nFirstQueuedTime + nWindow - GetTimeMillis();
+                    if (nWait <= 0)
+                        break;
+                    cond.wait_for(lock, std::chrono::milliseconds(nWait));
+                }
+                if (vQueued.size() <= nMaxBatch) {
+                    vBatch.swap(vQueued);
+                } else {
+                    vBatch.assign(std::make_move_iterator(vQueued.begin()), std::make_move_iterator(vQueued.begin() + nMaxBatch));
+                    vQueued.erase(vQueued.begin(), vQueued.begin() + nMaxBatch);
+                    nFirstQueuedTime = GetTimeMillis();
+                }
+            }
+
+            try {
+                fnProcess(vBatch);
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "CTxBatchQueue::Thread()");
+            }
+        }
+    }
+
+public:
+    CTxBatchQueue(std::function<void(std::vector<T>&)> fnProcessIn, int64_t nWindowIn, size_t nMaxBatchIn, size_t nMaxQueuedIn) :
+        nFirstQueuedTime(0), fnProcess(fnProcessIn), nWindow(nWindowIn), nMaxBatch(std::max<size_t>(1, nMaxBatchIn)), nMaxQueued(nMaxQueuedIn), fStopped(false)
+    {
+        thread = std::thread(&CTxBatchQueue::Thread, this);
+    }
+
+    ~CTxBatchQueue()
+    {
+        Stop();
+    }
+
+    //! Queue item for the next batch, unless the queue is full or stopped
+    bool Add(T item)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fStopped || vQueued.size() >= nMaxQueued)
+                return false;
+            if (vQueued.empty())
+                nFirstQueuedTime = GetTimeMillis();
+            vQueued.push_back(std::move(item));
+            if (vQueued.size() != 1 && vQueued.size() != nMaxBatch)
+                return true;
+        }
+        cond.notify_one();
+        return true;
+    }
+
+    //! Process the items still queued and stop the thread; later items are refused
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fStopped)
+                return;
+            fStopped = true;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+};
+
+#endif // BITCOIN_TXACCEPTQUEUE_H
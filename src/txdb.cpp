@@ -54,15 +54,39 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBProfile& profile) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, profile), fWriting(false), fWriteFailed(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (threadWriter.joinable())
+        threadWriter.join();
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        LOCK(cs_pending);
+        if (mapPending) {
+            CCoinsMap::const_iterator it = mapPending->find(outpoint);
+            if (it != mapPending->end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        LOCK(cs_pending);
+        if (mapPending) {
+            CCoinsMap::const_iterator it = mapPending->find(outpoint);
+            if (it != mapPending->end())
+                return !it->second.coin.IsSpent();
+        }
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
@@ -82,6 +106,12 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!WaitForPendingWrites())
+        return false;
+    return WriteCoins(mapCoins, hashBlock);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -106,6 +136,9 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
+    // Entries are only erased once their batch is committed, as reads may
+    // still be served from mapCoins (see BatchWriteAsync).
+    CCoinsMap::iterator itBatchBegin = mapCoins.begin();
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
@@ -116,12 +149,15 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        ++it;
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
             batch.Clear();
+            {
+                LOCK(cs_pending);
+                itBatchBegin = mapCoins.erase(itBatchBegin, it);
+            }
             if (crash_simulate) {
                 static FastRandomContext rng;
                 if (rng.randrange(crash_simulate) == 0) {
@@ -138,16 +174,66 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
+    {
+        LOCK(cs_pending);
+        mapCoins.erase(itBatchBegin, mapCoins.end());
+    }
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
 
+bool CCoinsViewDB::BatchWriteAsync(CCoinsViewCache &cache, bool fEvict) {
+    if (!WaitForPendingWrites())
+        return false;
+    hashPendingBlock = cache.GetBestBlock();
+    {
+        LOCK(cs_pending);
+        pendingMemoryResource.reset(new CCoinsMapMemoryResource());
+        mapPending.reset(new CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), pendingMemoryResource.get()));
+        cache.Sync(*mapPending, fEvict);
+    }
+    LogPrint(BCLog::COINDB, "Writing %u transaction outputs to coin database in the background\n", (unsigned int)mapPending->size());
+    fWriting = true;
+    threadWriter = std::thread(&CCoinsViewDB::ThreadWriter, this);
+    return true;
+}
+
+void CCoinsViewDB::ThreadWriter() {
+    RenameThread("faircoin-coinsdb");
+    bool ret = false;
+    try {
+        ret = WriteCoins(*mapPending, hashPendingBlock);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    fWriteFailed = !ret;
+    fWriting = false;
+}
+
+bool CCoinsViewDB::WaitForPendingWrites() {
+    if (threadWriter.joinable())
+        threadWriter.join();
+    // After a failure the modifications stay visible to reads; the caller is
+    // expected to shut down.
+    if (fWriteFailed)
+        return false;
+    LOCK(cs_pending);
+    mapPending.reset();
+    pendingMemoryResource.reset();
+    return true;
+}
+
+size_t CCoinsViewDB::PendingMemoryUsage() const {
+    LOCK(cs_pending);
+    return mapPending ? memusage::DynamicUsage(*mapPending) : 0;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBProfile& profile) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, profile) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -286,15 +372,14 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
-
-                // FairCoin: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every Litecoin startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                // if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                //     return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+                pindexNew->hashPoW        = diskindex.hashPoW;
+
+                // FairCoin: We use the sha256 hash for the block index for performance reasons.
+                // Recomputing the yespower hash of every header would take several minutes on
+                // every startup, so we check the PoW hash recorded when the header was first
+                // accepted instead. Entries written before it was recorded are trusted as-is.
+                if ((pindexNew->nStatus & BLOCK_HAVE_POW_HASH) && !CheckProofOfWork(pindexNew->hashPoW, pindexNew->nBits, consensusParams))
+                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
 
                 pcursor->Next();
             } else {
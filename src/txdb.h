@@ -9,9 +9,13 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -68,8 +72,26 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * Modifications handed to BatchWriteAsync, which threadWriter has not
+     * committed yet. Reads look here before going to the database. Only
+     * threadWriter erases from the map, and only while holding cs_pending.
+     */
+    mutable CCriticalSection cs_pending;
+    std::unique_ptr<CCoinsMapMemoryResource> pendingMemoryResource;
+    std::unique_ptr<CCoinsMap> mapPending;
+    uint256 hashPendingBlock;
+    std::thread threadWriter;
+    std::atomic<bool> fWriting;
+    bool fWriteFailed;
+
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    void ThreadWriter();
+
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBProfile& profile = CDBProfile());
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -78,6 +100,22 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Start writing the modifications of cache, a view on top of this one, from
+     * a background thread, in batches of -dbbatchsize. The modifications are
+     * visible to reads right away, but the best block on disk only moves to
+     * the cache's once all of them have been committed. The cache keeps its
+     * entries, unmodified, unless fEvict is set. Waits for an earlier write to
+     * finish first. Like WaitForPendingWrites, callers must be serialized.
+     */
+    bool BatchWriteAsync(CCoinsViewCache &cache, bool fEvict);
+    //! Wait for the write started by BatchWriteAsync. Returns false if it failed.
+    bool WaitForPendingWrites();
+    //! Whether a write started by BatchWriteAsync is still running
+    bool IsWriting() const { return fWriting; }
+    //! Memory used by modifications that are still being written
+    size_t PendingMemoryUsage() const;
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -109,7 +147,7 @@ private:
 class CBlockTreeDB : public CDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBProfile& profile = CDBProfile());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
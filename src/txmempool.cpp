@@ -67,13 +67,14 @@ size_t CTxMemPoolEntry::GetTxSize() const
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
     setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    const vecEntries &updateChildren = GetMemPoolChildren(updateIt);
+    stageEntries.insert(updateChildren.begin(), updateChildren.end());
 
     while (!stageEntries.empty()) {
         const txiter cit = *stageEntries.begin();
         setAllDescendants.insert(cit);
         stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
+        const vecEntries &setChildren = GetMemPoolChildren(cit);
         for (const txiter childEntry : setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
@@ -152,6 +153,9 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
+    // Descendant state changed without entries being added or removed
+    if (!vHashesToUpdate.empty())
+        nTransactionsUpdated++;
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
@@ -179,7 +183,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        const vecEntries &parents = GetMemPoolParents(it);
+        parentHashes.insert(parents.begin(), parents.end());
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
@@ -202,7 +207,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
+        const vecEntries & setMemPoolParents = GetMemPoolParents(stageit);
         for (const txiter &phash : setMemPoolParents) {
             // If this is a new ancestor, add it.
             if (setAncestors.count(phash) == 0) {
@@ -220,7 +225,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const vecEntries &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     for (txiter piter : parentIters) {
         UpdateChild(piter, it, add);
@@ -249,7 +254,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const vecEntries &setMemPoolChildren = GetMemPoolChildren(it);
     for (txiter updateIt : setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
@@ -370,7 +375,9 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    vTxHashes.emplace_back(entry.GetTx().GetWitnessHash(), newit);
+    vTxLinks.emplace_back();
+    newit->vTxHashesIdx = vTxHashes.size() - 1;
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -415,9 +422,6 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     totalTxSize += entry.GetTxSize();
     if (minerPolicyEstimator) {minerPolicyEstimator->processTransaction(entry, validFeeEstimate);}
 
-    vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
-    newit->vTxHashesIdx = vTxHashes.size() - 1;
-
     return true;
 }
 
@@ -428,21 +432,28 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
 
+    cachedInnerUsage -= memusage::DynamicUsage(vTxLinks[it->vTxHashesIdx].parents) + memusage::DynamicUsage(vTxLinks[it->vTxHashesIdx].children);
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
+        vTxLinks[it->vTxHashesIdx] = std::move(vTxLinks.back());
         vTxHashes[it->vTxHashesIdx].second->vTxHashesIdx = it->vTxHashesIdx;
         vTxHashes.pop_back();
-        if (vTxHashes.size() * 2 < vTxHashes.capacity())
+        vTxLinks.pop_back();
+        if (vTxHashes.size() * 2 < vTxHashes.capacity()) {
             vTxHashes.shrink_to_fit();
-    } else
+            vTxLinks.shrink_to_fit();
+        }
+    } else {
         vTxHashes.clear();
+        vTxLinks.clear();
+    }
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
+    // Don't keep removed transactions alive through a snapshot nobody reads anymore
+    snapshot.reset();
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
 }
 
@@ -466,7 +477,7 @@ void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants
         setDescendants.insert(it);
         stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const vecEntries &setChildren = GetMemPoolChildren(it);
         for (const txiter &childiter : setChildren) {
             if (!setDescendants.count(childiter)) {
                 stage.insert(childiter);
@@ -595,7 +606,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
+    vTxHashes.clear();
+    vTxLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
@@ -603,6 +615,7 @@ void CTxMemPool::_clear()
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
+    snapshot.reset();
     ++nTransactionsUpdated;
 }
 
@@ -635,9 +648,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
+        assert(it->vTxHashesIdx < vTxLinks.size() && vTxHashes[it->vTxHashesIdx].second == it);
+        const TxLinks &links = vTxLinks[it->vTxHashesIdx];
         innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
         bool fDependsWait = false;
         setEntries setParentCheck;
@@ -664,7 +676,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setParentCheck.size() == links.parents.size());
+        assert(setParentCheck == setEntries(links.parents.begin(), links.parents.end()));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -697,7 +710,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck.size() == links.children.size());
+        assert(setChildrenCheck == setEntries(links.children.begin(), links.children.end()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -817,6 +831,79 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+CTxMemPoolSnapshot::CTxMemPoolSnapshot(unsigned int nEpochIn, std::vector<Entry>&& vEntriesIn) :
+    nEpoch(nEpochIn), vEntries(std::move(vEntriesIn))
+{
+    std::sort(vEntries.begin(), vEntries.end(), [](const Entry& a, const Entry& b) {
+        return a.tx->GetHash() < b.tx->GetHash();
+    });
+}
+
+const CTxMemPoolSnapshot::Entry* CTxMemPoolSnapshot::find(const uint256& hash) const
+{
+    auto it = std::lower_bound(vEntries.begin(), vEntries.end(), hash, [](const Entry& e, const uint256& h) {
+        return e.tx->GetHash() < h;
+    });
+    if (it == vEntries.end() || it->tx->GetHash() != hash)
+        return nullptr;
+    return &*it;
+}
+
+CTxMemPoolSnapshot::Entry CTxMemPool::GetSnapshotEntry(txiter it) const
+{
+    CTxMemPoolSnapshot::Entry e;
+    e.tx = it->GetSharedTx();
+    e.nFee = it->GetFee();
+    e.nModifiedFee = it->GetModifiedFee();
+    e.nTxSize = it->GetTxSize();
+    e.nTime = it->GetTime();
+    e.nHeight = it->GetHeight();
+    e.nCountWithDescendants = it->GetCountWithDescendants();
+    e.nSizeWithDescendants = it->GetSizeWithDescendants();
+    e.nModFeesWithDescendants = it->GetModFeesWithDescendants();
+    e.nCountWithAncestors = it->GetCountWithAncestors();
+    e.nSizeWithAncestors = it->GetSizeWithAncestors();
+    e.nModFeesWithAncestors = it->GetModFeesWithAncestors();
+    const vecEntries& parents = GetMemPoolParents(it);
+    e.vParents.reserve(parents.size());
+    for (txiter parent : parents)
+        e.vParents.push_back(parent->GetTx().GetHash());
+    return e;
+}
+
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    std::vector<CTxMemPoolSnapshot::Entry> vEntries;
+    unsigned int nEpoch;
+    {
+        LOCK(cs);
+        if (snapshot && snapshot->nEpoch == nTransactionsUpdated)
+            return snapshot;
+        nEpoch = nTransactionsUpdated;
+        vEntries.reserve(mapTx.size());
+        for (txiter it = mapTx.begin(); it != mapTx.end(); ++it)
+            vEntries.push_back(GetSnapshotEntry(it));
+    }
+
+    // Sorted without holding cs; if the pool changed meanwhile the snapshot
+    // is still consistent, it just isn't kept for the next caller
+    std::shared_ptr<const CTxMemPoolSnapshot> newsnapshot = std::make_shared<const CTxMemPoolSnapshot>(nEpoch, std::move(vEntries));
+    LOCK(cs);
+    if (nEpoch == nTransactionsUpdated)
+        snapshot = newsnapshot;
+    return newsnapshot;
+}
+
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot(const setEntries& entries) const
+{
+    AssertLockHeld(cs);
+    std::vector<CTxMemPoolSnapshot::Entry> vEntries;
+    vEntries.reserve(entries.size());
+    for (txiter it : entries)
+        vEntries.push_back(GetSnapshotEntry(it));
+    return std::make_shared<const CTxMemPoolSnapshot>(nTransactionsUpdated, std::move(vEntries));
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -910,7 +997,7 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -947,40 +1034,45 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+/** Add link to or remove it from links, keeping track of the memory links use */
+static void UpdateLink(CTxMemPool::vecEntries& links, CTxMemPool::txiter link, bool add, uint64_t& cachedInnerUsage)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPool::vecEntries::iterator it = std::find(links.begin(), links.end(), link);
+    if (add == (it != links.end()))
+        return;
+    cachedInnerUsage -= memusage::DynamicUsage(links);
+    if (add) {
+        links.push_back(link);
+    } else {
+        // Order doesn't matter, so fill the gap with the last link
+        *it = links.back();
+        links.pop_back();
     }
+    cachedInnerUsage += memusage::DynamicUsage(links);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    UpdateLink(vTxLinks[entry->vTxHashesIdx].children, child, add, cachedInnerUsage);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLink(vTxLinks[entry->vTxHashesIdx].parents, parent, add, cachedInnerUsage);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    assert(entry->vTxHashesIdx < vTxLinks.size());
+    return vTxLinks[entry->vTxHashesIdx].parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    assert(entry->vTxHashesIdx < vTxLinks.size());
+    return vTxLinks[entry->vTxHashesIdx].children;
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
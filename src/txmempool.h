@@ -17,6 +17,7 @@
 #include "coins.h"
 #include "indirectmap.h"
 #include "policy/feerate.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
@@ -130,7 +131,7 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes and vTxLinks
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -313,6 +314,43 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * Immutable copy of the state of mempool entries at one point in time.
+ * Readers share it through a std::shared_ptr and walk it without holding
+ * the mempool lock, so that formatting a large pool for RPC doesn't stall
+ * transaction admission. It is released with its last reader.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    struct Entry
+    {
+        CTransactionRef tx;
+        CAmount nFee;
+        CAmount nModifiedFee;
+        size_t nTxSize;
+        int64_t nTime;
+        unsigned int nHeight;
+        uint64_t nCountWithDescendants;
+        uint64_t nSizeWithDescendants;
+        CAmount nModFeesWithDescendants;
+        uint64_t nCountWithAncestors;
+        uint64_t nSizeWithAncestors;
+        CAmount nModFeesWithAncestors;
+        std::vector<uint256> vParents; //!< txids of the direct in-mempool parents
+    };
+
+    //! CTxMemPool::GetTransactionsUpdated() when the snapshot was taken
+    unsigned int nEpoch;
+    //! The entries, sorted by txid
+    std::vector<Entry> vEntries;
+
+    CTxMemPoolSnapshot(unsigned int nEpochIn, std::vector<Entry>&& vEntriesIn);
+
+    /** The entry of a transaction, or nullptr if it is not in the snapshot */
+    const Entry* find(const uint256& hash) const;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -367,7 +405,7 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the set of in-mempool direct parents and direct children in vTxLinks.  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
@@ -400,7 +438,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * vTxLinks may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -426,6 +464,8 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> snapshot; //!< Last snapshot of the whole pool, reused while nTransactionsUpdated is unchanged
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -476,23 +516,27 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    //! Direct in-mempool parents or children of an entry, of which there are rarely more than a few
+    typedef prevector<2, txiter> vecEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const vecEntries & GetMemPoolParents(txiter entry) const;
+    const vecEntries & GetMemPoolChildren(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        vecEntries parents;
+        vecEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    //! Links of each entry in mapTx, at the entry's vTxHashesIdx
+    std::vector<TxLinks> vTxLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    CTxMemPoolSnapshot::Entry GetSnapshotEntry(txiter it) const;
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
 public:
@@ -571,7 +615,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from vTxLinks. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
@@ -622,6 +666,13 @@ public:
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /** Snapshot of the whole pool. It is shared by all callers until the pool
+     *  changes, and taking a new one holds cs only while the entries are copied. */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
+    /** Snapshot of just the given entries, e.g. a transaction and its ancestors.
+     *  cs must be held. */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot(const setEntries& entries) const;
+
     size_t DynamicMemoryUsage() const;
 
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
@@ -6,10 +6,13 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockfilemap.h"
+#include "blockfilereader.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
@@ -30,6 +33,7 @@
 #include "script/sigcache.h"
 #include "script/standard.h"
 #include "timedata.h"
+#include "txacceptqueue.h"
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -65,6 +69,7 @@ CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+unsigned int nPipelineConnectBlocks = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
@@ -201,6 +206,11 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewDB *pcoinsdbview = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
 CBlockTreeDB *pblocktree = nullptr;
+/** Reads the coins of the next block to connect from pcoinsdbview. Guarded by cs_main. */
+static std::unique_ptr<CCoinsPrefetcher> coinsPrefetcher;
+
+/** Block files mapped into memory for ReadBlockFromDisk */
+static CBlockFileMap blockFileMap(MAX_MAPPED_BLOCK_FILES);
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -214,6 +224,8 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static void AddScriptExecutionCache(const CTransaction& tx, unsigned int flags);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -424,14 +436,9 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
 
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
-static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+static bool CheckCoinsFromMempoolAndCache(const CTransaction& tx, const CCoinsViewCache &view, CTxMemPool& pool) {
     AssertLockHeld(cs_main);
-
-    // pool.cs should be locked already, but go ahead and re-take the lock here
-    // to enforce that mempool doesn't change between when we check the view
-    // and when we actually call through to CheckInputs
-    LOCK(pool.cs);
+    AssertLockHeld(pool.cs);
 
     assert(!tx.IsCoinBase());
     for (const CTxIn& txin : tx.vin) {
@@ -455,16 +462,75 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
         }
     }
 
+    return true;
+}
+
+static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
+                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+    AssertLockHeld(cs_main);
+
+    // pool.cs should be locked already, but go ahead and re-take the lock here
+    // to enforce that mempool doesn't change between when we check the view
+    // and when we actually call through to CheckInputs
+    LOCK(pool.cs);
+
+    if (!CheckCoinsFromMempoolAndCache(tx, view, pool))
+        return false;
+
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+namespace {
+
+/**
+ * A transaction on its way into the mempool, handed from one stage of
+ * AcceptToMemoryPoolWorker to the next.
+ */
+struct MemPoolAccept
+{
+    const CTransactionRef ptx;
+    //! The coins spent by the transaction, copied in by PreChecks
+    CCoinsView dummy;
+    CCoinsViewCache view;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    CAmount nModifiedFees = 0;
+    CAmount nConflictingFees = 0;
+    size_t nConflictingSize = 0;
+    std::set<uint256> setConflicts;
+    //! Mempool iterators, only valid while the locks taken for PreChecks are held
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::setEntries allConflicting;
+    unsigned int scriptVerifyFlags = 0;
+    unsigned int currentBlockScriptVerifyFlags = 0;
+
+    explicit MemPoolAccept(const CTransactionRef& ptxIn) : ptx(ptxIn), view(&dummy) {}
+};
+
+} // namespace
+
+/** The script flags transactions are checked with before they go in the mempool */
+static unsigned int GetMempoolScriptVerifyFlags(const CChainParams& chainparams)
 {
+    unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        flags = gArgs.GetArg("-promiscuousmempoolflags", flags);
+    }
+    return flags;
+}
+
+/**
+ * Everything AcceptToMemoryPool checks except for the scripts: policy, inputs,
+ * fees, package limits and replacement rules. Copies the coins spent into
+ * ws.view, so the scripts can then be checked without any lock held.
+ */
+static bool PreChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, MemPoolAccept& ws, bool fLimitFree,
+                      bool* pfMissingInputs, int64_t nAcceptTime, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransactionRef& ptx = ws.ptx;
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -498,7 +564,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     // Check for conflicts with in-memory transactions
-    std::set<uint256> setConflicts;
+    std::set<uint256>& setConflicts = ws.setConflicts;
     {
     LOCK(pool.cs); // protect pool.mapNextTx
     for (const CTxIn &txin : tx.vin)
@@ -543,348 +609,400 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
     }
 
+    CCoinsView& dummy = ws.dummy;
+    CCoinsViewCache& view = ws.view;
+
+    CAmount nValueIn = 0;
+    LockPoints lp;
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+    LOCK(pool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    view.SetBackend(viewMemPool);
 
-        CAmount nValueIn = 0;
-        LockPoints lp;
-        {
-        LOCK(pool.cs);
-        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-        view.SetBackend(viewMemPool);
-
-        // do all inputs exist?
-        for (const CTxIn txin : tx.vin) {
-            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                coins_to_uncache.push_back(txin.prevout);
-            }
-            if (!view.HaveCoin(txin.prevout)) {
-                // Are inputs missing because we already have the tx?
-                for (size_t out = 0; out < tx.vout.size(); out++) {
-                    // Optimistically just do efficient check of cache for outputs
-                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
-                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
-                    }
-                }
-                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
-                if (pfMissingInputs) {
-                    *pfMissingInputs = true;
+    // do all inputs exist?
+    for (const CTxIn txin : tx.vin) {
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+            coins_to_uncache.push_back(txin.prevout);
+        }
+        if (!view.HaveCoin(txin.prevout)) {
+            // Are inputs missing because we already have the tx?
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                // Optimistically just do efficient check of cache for outputs
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                    return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
                 }
-                return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
+            // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+            if (pfMissingInputs) {
+                *pfMissingInputs = true;
+            }
+            return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
         }
+    }
 
-        // Bring the best block into scope
-        view.GetBestBlock();
-
-        nValueIn = view.GetValueIn(tx);
-
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
-
-        // Only accept BIP68 sequence locked transactions that can be mined in the next
-        // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
-        }
-
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+    // Bring the best block into scope
+    view.GetBestBlock();
 
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    nValueIn = view.GetValueIn(tx);
 
-        CAmount nValueOut = tx.GetValueOut();
-        CAmount nFees = nValueIn-nValueOut;
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
+    // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
+    view.SetBackend(dummy);
 
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    }
+
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+
+    CAmount nValueOut = tx.GetValueOut();
+    CAmount nFees = nValueIn-nValueOut;
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    CAmount& nModifiedFees = ws.nModifiedFees;
+    nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
+
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
-                              fSpendsCoinbase, nSigOpsCost, lp);
-        unsigned int nSize = entry.GetTxSize();
+    ws.entry.reset(new CTxMemPoolEntry(ptx, nFees, nAcceptTime, chainActive.Height(),
+                                       fSpendsCoinbase, nSigOpsCost, lp));
+    const CTxMemPoolEntry& entry = *ws.entry;
+    unsigned int nSize = entry.GetTxSize();
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        }
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
 
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
 
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
-        }
+    // Calculate in-mempool ancestors, up to a limit.
+    CTxMemPool::setEntries& setAncestors = ws.setAncestors;
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+    }
 
-        // A transaction that spends outputs that would be replaced by it is invalid. Now
-        // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
-        // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+    // A transaction that spends outputs that would be replaced by it is invalid. Now
+    // that we have the set of all ancestors we can detect this
+    // pathological case by making sure setConflicts and setAncestors don't
+    // intersect.
+    for (CTxMemPool::txiter ancestorIt : setAncestors)
+    {
+        const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
+        if (setConflicts.count(hashAncestor))
         {
-            const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
-            if (setConflicts.count(hashAncestor))
-            {
-                return state.DoS(10, false,
-                                 REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
-                                 strprintf("%s spends conflicting transaction %s",
-                                           hash.ToString(),
-                                           hashAncestor.ToString()));
-            }
+            return state.DoS(10, false,
+                             REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
+                             strprintf("%s spends conflicting transaction %s",
+                                       hash.ToString(),
+                                       hashAncestor.ToString()));
         }
+    }
 
-        // Check if it's economically rational to mine this transaction rather
-        // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
-        uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+    // Check if it's economically rational to mine this transaction rather
+    // than the ones it replaces.
+    CAmount& nConflictingFees = ws.nConflictingFees;
+    size_t& nConflictingSize = ws.nConflictingSize;
+    uint64_t nConflictingCount = 0;
+    CTxMemPool::setEntries& allConflicting = ws.allConflicting;
 
-        // If we don't hold the lock allConflicting might be incomplete; the
-        // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
-        LOCK(pool.cs);
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
+    // If we don't hold the lock allConflicting might be incomplete; the
+    // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
+    // mempool consistency for us, so the caller has to keep holding it.
+    AssertLockHeld(pool.cs);
+    const bool fReplacementTransaction = setConflicts.size();
+    if (fReplacementTransaction)
+    {
+        CFeeRate newFeeRate(nModifiedFees, nSize);
+        std::set<uint256> setConflictsParents;
+        const int maxDescendantsToVisit = 100;
+        CTxMemPool::setEntries setIterConflicting;
+        for (const uint256 &hashConflicting : setConflicts)
         {
-            CFeeRate newFeeRate(nModifiedFees, nSize);
-            std::set<uint256> setConflictsParents;
-            const int maxDescendantsToVisit = 100;
-            CTxMemPool::setEntries setIterConflicting;
-            for (const uint256 &hashConflicting : setConflicts)
-            {
-                CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
-                if (mi == pool.mapTx.end())
-                    continue;
-
-                // Save these to avoid repeated lookups
-                setIterConflicting.insert(mi);
-
-                // Don't allow the replacement to reduce the feerate of the
-                // mempool.
-                //
-                // We usually don't want to accept replacements with lower
-                // feerates than what they replaced as that would lower the
-                // feerate of the next block. Requiring that the feerate always
-                // be increased is also an easy-to-reason about way to prevent
-                // DoS attacks via replacements.
-                //
-                // The mining code doesn't (currently) take children into
-                // account (CPFP) so we only consider the feerates of
-                // transactions being directly replaced, not their indirect
-                // descendants. While that does mean high feerate children are
-                // ignored when deciding whether or not to replace, we do
-                // require the replacement to pay more overall fees too,
-                // mitigating most cases.
-                CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
-                if (newFeeRate <= oldFeeRate)
-                {
-                    return state.DoS(0, false,
-                            REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                            strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
-                                  hash.ToString(),
-                                  newFeeRate.ToString(),
-                                  oldFeeRate.ToString()));
-                }
-
-                for (const CTxIn &txin : mi->GetTx().vin)
-                {
-                    setConflictsParents.insert(txin.prevout.hash);
-                }
+            CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
+            if (mi == pool.mapTx.end())
+                continue;
 
-                nConflictingCount += mi->GetCountWithDescendants();
-            }
-            // This potentially overestimates the number of actual descendants
-            // but we just want to be conservative to avoid doing too much
-            // work.
-            if (nConflictingCount <= maxDescendantsToVisit) {
-                // If not too many to replace, then calculate the set of
-                // transactions that would have to be evicted
-                for (CTxMemPool::txiter it : setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
-                for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
-                    nConflictingSize += it->GetTxSize();
-                }
-            } else {
+            // Save these to avoid repeated lookups
+            setIterConflicting.insert(mi);
+
+            // Don't allow the replacement to reduce the feerate of the
+            // mempool.
+            //
+            // We usually don't want to accept replacements with lower
+            // feerates than what they replaced as that would lower the
+            // feerate of the next block. Requiring that the feerate always
+            // be increased is also an easy-to-reason about way to prevent
+            // DoS attacks via replacements.
+            //
+            // The mining code doesn't (currently) take children into
+            // account (CPFP) so we only consider the feerates of
+            // transactions being directly replaced, not their indirect
+            // descendants. While that does mean high feerate children are
+            // ignored when deciding whether or not to replace, we do
+            // require the replacement to pay more overall fees too,
+            // mitigating most cases.
+            CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
+            if (newFeeRate <= oldFeeRate)
+            {
                 return state.DoS(0, false,
-                        REJECT_NONSTANDARD, "too many potential replacements", false,
-                        strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
-                            hash.ToString(),
-                            nConflictingCount,
-                            maxDescendantsToVisit));
+                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                        strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
+                              hash.ToString(),
+                              newFeeRate.ToString(),
+                              oldFeeRate.ToString()));
             }
 
-            for (unsigned int j = 0; j < tx.vin.size(); j++)
+            for (const CTxIn &txin : mi->GetTx().vin)
             {
-                // We don't want to accept replacements that require low
-                // feerate junk to be mined first. Ideally we'd keep track of
-                // the ancestor feerates and make the decision based on that,
-                // but for now requiring all new inputs to be confirmed works.
-                if (!setConflictsParents.count(tx.vin[j].prevout.hash))
-                {
-                    // Rather than check the UTXO set - potentially expensive -
-                    // it's cheaper to just check if the new input refers to a
-                    // tx that's in the mempool.
-                    if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
-                        return state.DoS(0, false,
-                                         REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
-                                         strprintf("replacement %s adds unconfirmed input, idx %d",
-                                                  hash.ToString(), j));
-                }
+                setConflictsParents.insert(txin.prevout.hash);
             }
 
-            // The replacement must pay greater fees than the transactions it
-            // replaces - if we did the bandwidth used by those conflicting
-            // transactions would not be paid for.
-            if (nModifiedFees < nConflictingFees)
-            {
-                return state.DoS(0, false,
-                                 REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                                 strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
-                                          hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
+            nConflictingCount += mi->GetCountWithDescendants();
+        }
+        // This potentially overestimates the number of actual descendants
+        // but we just want to be conservative to avoid doing too much
+        // work.
+        if (nConflictingCount <= maxDescendantsToVisit) {
+            // If not too many to replace, then calculate the set of
+            // transactions that would have to be evicted
+            for (CTxMemPool::txiter it : setIterConflicting) {
+                pool.CalculateDescendants(it, allConflicting);
             }
+            for (CTxMemPool::txiter it : allConflicting) {
+                nConflictingFees += it->GetModifiedFee();
+                nConflictingSize += it->GetTxSize();
+            }
+        } else {
+            return state.DoS(0, false,
+                    REJECT_NONSTANDARD, "too many potential replacements", false,
+                    strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
+                        hash.ToString(),
+                        nConflictingCount,
+                        maxDescendantsToVisit));
+        }
 
-            // Finally in addition to paying more fees than the conflicts the
-            // new transaction must pay for its own bandwidth.
-            CAmount nDeltaFees = nModifiedFees - nConflictingFees;
-            if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            // We don't want to accept replacements that require low
+            // feerate junk to be mined first. Ideally we'd keep track of
+            // the ancestor feerates and make the decision based on that,
+            // but for now requiring all new inputs to be confirmed works.
+            if (!setConflictsParents.count(tx.vin[j].prevout.hash))
             {
-                return state.DoS(0, false,
-                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                        strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
-                              hash.ToString(),
-                              FormatMoney(nDeltaFees),
-                              FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+                // Rather than check the UTXO set - potentially expensive -
+                // it's cheaper to just check if the new input refers to a
+                // tx that's in the mempool.
+                if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
+                    return state.DoS(0, false,
+                                     REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
+                                     strprintf("replacement %s adds unconfirmed input, idx %d",
+                                              hash.ToString(), j));
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!chainparams.RequireStandard()) {
-            scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        // The replacement must pay greater fees than the transactions it
+        // replaces - if we did the bandwidth used by those conflicting
+        // transactions would not be paid for.
+        if (nModifiedFees < nConflictingFees)
+        {
+            return state.DoS(0, false,
+                             REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                             strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
+                                      hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
         }
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
+        // Finally in addition to paying more fees than the conflicts the
+        // new transaction must pay for its own bandwidth.
+        CAmount nDeltaFees = nModifiedFees - nConflictingFees;
+        if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
         {
-            // If we're using promiscuousmempoolflags, we may hit this normally
-            // Check if current block has some flags that scriptVerifyFlags
-            // does not before printing an ominous warning
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+            return state.DoS(0, false,
+                    REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                    strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
+                          hash.ToString(),
+                          FormatMoney(nDeltaFees),
+                          FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+        }
+    }
+
+    ws.scriptVerifyFlags = GetMempoolScriptVerifyFlags(chainparams);
+    ws.currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), chainparams.GetConsensus());
+
+    // The inexpensive part of CheckInputs, with the scripts left for ScriptChecks
+    return Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view));
+}
+
+/**
+ * Check the scripts of a transaction that passed PreChecks against the coins
+ * in ws.view. With fLocked false this is done without cs_main held, which
+ * leaves out the script execution cache.
+ */
+static bool ScriptChecks(CTxMemPool& pool, CValidationState& state, MemPoolAccept& ws, bool fLocked)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256 hash = tx.GetHash();
+    const CCoinsViewCache& view = ws.view;
+    const unsigned int scriptVerifyFlags = ws.scriptVerifyFlags;
+    const unsigned int currentBlockScriptVerifyFlags = ws.currentBlockScriptVerifyFlags;
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    PrecomputedTransactionData txdata(tx);
+    // Without cs_main the script execution cache can't be used; the rest of
+    // CheckInputs has been done by PreChecks already
+    auto checkInputs = [&](CValidationState& stateCheck, unsigned int flags) {
+        return fLocked ? CheckInputs(tx, stateCheck, view, true, flags, true, false, txdata) :
+                         CheckInputScripts(tx, stateCheck, view, flags, true, txdata);
+    };
+    if (!checkInputs(state, scriptVerifyFlags)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputs
+        if (!tx.HasWitness() && checkInputs(stateDummy, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK)) &&
+            !checkInputs(stateDummy, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false; // state filled in by CheckInputs
+    }
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    // Without cs_main, the caller adds the result to the cache.
+    if (fLocked ? !CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata) :
+                  !CheckInputScripts(tx, state, view, currentBlockScriptVerifyFlags, true, txdata))
+    {
+        // If we're using promiscuousmempoolflags, we may hit this normally
+        // Check if current block has some flags that scriptVerifyFlags
+        // does not before printing an ominous warning
+        if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        } else {
+            if (!checkInputs(state, MANDATORY_SCRIPT_VERIFY_FLAGS)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
             } else {
-                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
-                    return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
-                        __func__, hash.ToString(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
-                }
+                LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
             }
         }
+    }
 
-        // Remove conflicting transactions from the mempool
-        for (const CTxMemPool::txiter it : allConflicting)
-        {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
-        }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+    return true;
+}
+
+/** Add a transaction that passed PreChecks and ScriptChecks to the mempool, replacing its conflicts */
+static bool Finalize(CTxMemPool& pool, CValidationState& state, MemPoolAccept& ws, std::list<CTransactionRef>* plTxnReplaced, bool fOverrideMempoolLimit)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = *ws.ptx;
+    const uint256 hash = tx.GetHash();
 
-        // This transaction should only count for fee estimation if it isn't a
-        // BIP 125 replacement transaction (may not be widely supported), the
-        // node is not behind, and the transaction is not dependent on any other
-        // transactions in the mempool.
-        bool validForFeeEstimation = !fReplacementTransaction && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+    // Remove conflicting transactions from the mempool
+    for (const CTxMemPool::txiter it : ws.allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(ws.nModifiedFees - ws.nConflictingFees),
+                (int)ws.entry->GetTxSize() - (int)ws.nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(ws.allConflicting, false, MemPoolRemovalReason::REPLACED);
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
+    // This transaction should only count for fee estimation if it isn't a
+    // BIP 125 replacement transaction (may not be widely supported), the
+    // node is not behind, and the transaction is not dependent on any other
+    // transactions in the mempool.
+    bool validForFeeEstimation = ws.setConflicts.empty() && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
 
-        // trim mempool and check if tx was trimmed
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-        }
+    // Store transaction in memory
+    pool.addUnchecked(hash, *ws.entry, ws.setAncestors, validForFeeEstimation);
+
+    // trim mempool and check if tx was trimmed
+    if (!fOverrideMempoolLimit) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+
+    return true;
+}
+
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    AssertLockHeld(cs_main);
+    {
+        LOCK(pool.cs); // Keep the mempool as PreChecks saw it until the transaction is added
+        MemPoolAccept ws(ptx);
+        if (!PreChecks(chainparams, pool, state, ws, fLimitFree, pfMissingInputs, nAcceptTime, nAbsurdFee, coins_to_uncache))
+            return false;
+        if (!ScriptChecks(pool, state, ws, true))
+            return false;
+        if (!Finalize(pool, state, ws, plTxnReplaced, fOverrideMempoolLimit))
+            return false;
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -892,6 +1010,43 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     return true;
 }
 
+/**
+ * Add a transaction whose scripts were checked without the locks held, against
+ * the coins in ws.view, to the mempool.
+ */
+static bool RecheckAndFinalize(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const MemPoolAccept& ws, bool fLimitFree,
+                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                               bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransactionRef& ptx = ws.ptx;
+
+    // Blocks and other transactions may have come in meanwhile, so check
+    // everything but the scripts again. The scripts only depend on the
+    // coins spent, which the txids commit to, and on the flags.
+    MemPoolAccept wsFinal(ptx);
+    if (!PreChecks(chainparams, pool, state, wsFinal, fLimitFree, pfMissingInputs, nAcceptTime, nAbsurdFee, coins_to_uncache))
+        return false;
+    bool fScriptsChecked = wsFinal.scriptVerifyFlags == ws.scriptVerifyFlags &&
+                           wsFinal.currentBlockScriptVerifyFlags == ws.currentBlockScriptVerifyFlags;
+    for (const CTxIn& txin : ptx->vin) {
+        if (!(wsFinal.view.AccessCoin(txin.prevout).out == ws.view.AccessCoin(txin.prevout).out))
+            fScriptsChecked = false;
+    }
+    if (fScriptsChecked) {
+        // Only cache the result once the coins it was checked against are
+        // known to be the ones in the mempool and the chain, as
+        // CheckInputsFromMempoolAndCache makes sure of for the locked path
+        if (!CheckCoinsFromMempoolAndCache(*ptx, wsFinal.view, pool))
+            return state.Invalid(false, REJECT_INVALID, "bad-txns-inputs-missingorspent");
+        AddScriptExecutionCache(*ptx, ws.currentBlockScriptVerifyFlags);
+    } else if (!ScriptChecks(pool, state, wsFinal, true)) {
+        return false;
+    }
+    return Finalize(pool, state, wsFinal, plTxnReplaced, fOverrideMempoolLimit);
+}
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
@@ -917,6 +1072,69 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
 }
 
+/** AcceptToMemoryPoolBatch with a specified acceptance time for each transaction */
+static void AcceptToMemoryPoolBatchWithTime(const CChainParams& chainparams, CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, const std::vector<int64_t>& vAcceptTime,
+                                            std::vector<CTxAcceptResult>& vResults, bool fLimitFree, CTxAcceptQueue* queue)
+{
+    assert(vAcceptTime.size() == vtx.size());
+    vResults.assign(vtx.size(), CTxAcceptResult());
+    std::vector<std::unique_ptr<MemPoolAccept> > vws(vtx.size());
+    std::vector<std::vector<COutPoint> > vCoinsToUncache(vtx.size());
+
+    // Look up the coins of the whole batch in one go
+    {
+        LOCK2(cs_main, pool.cs);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            vws[i].reset(new MemPoolAccept(vtx[i]));
+            if (!PreChecks(chainparams, pool, vResults[i].state, *vws[i], fLimitFree, &vResults[i].fMissingInputs, vAcceptTime[i], 0, vCoinsToUncache[i]))
+                vws[i].reset();
+        }
+    }
+
+    // Check the scripts of the transactions in parallel, without the locks
+    std::vector<char> vScriptsOk(vtx.size(), false);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (!vws[i])
+            continue;
+        auto check = [&pool, &vResults, &vws, &vScriptsOk, i] {
+            vScriptsOk[i] = ScriptChecks(pool, vResults[i].state, *vws[i], false);
+        };
+        if (!queue || !queue->Add(check))
+            check();
+    }
+    if (queue)
+        queue->Wait();
+
+    // Add them in the order they came in, so a transaction that conflicts
+    // with an earlier one of the batch is the one rejected
+    {
+        LOCK(cs_main);
+        {
+            LOCK(pool.cs);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CTxAcceptResult& result = vResults[i];
+                if (vws[i] && vScriptsOk[i])
+                    result.fAccepted = RecheckAndFinalize(chainparams, pool, result.state, *vws[i], fLimitFree, &result.fMissingInputs, vAcceptTime[i], &result.lRemovedTxn, false, 0, vCoinsToUncache[i]);
+                if (!result.fAccepted) {
+                    for (const COutPoint& hashTx : vCoinsToUncache[i])
+                        pcoinsTip->Uncache(hashTx);
+                }
+            }
+        }
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (vResults[i].fAccepted)
+                GetMainSignals().TransactionAddedToMempool(vtx[i]);
+        }
+        CValidationState stateDummy;
+        FlushStateToDisk(chainparams, stateDummy, FLUSH_STATE_PERIODIC);
+    }
+}
+
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, std::vector<CTxAcceptResult>& vResults, bool fLimitFree, CTxAcceptQueue* queue)
+{
+    AcceptToMemoryPoolBatchWithTime(Params(), pool, vtx, std::vector<int64_t>(vtx.size(), GetTime()), vResults, fLimitFree, queue);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1008,6 +1226,19 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
+    // Deserialize straight from the mapped file if possible
+    CBlockFileSpan span;
+    if (!pos.IsNull() && blockFileMap.GetBlock(GetBlockPosFilename(pos, "blk"), pos, span)) {
+        try {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, span.pbegin, span.nSize);
+            reader >> block;
+            return true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1038,6 +1269,52 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    block.clear();
+
+    CBlockFileSpan span;
+    if (!pos.IsNull() && blockFileMap.GetBlock(GetBlockPosFilename(pos, "blk"), pos, span)) {
+        block.assign(span.pbegin, span.pbegin + span.nSize);
+    } else {
+        // Read the block header in front of the block as well
+        if (pos.nPos < 8)
+            return error("%s: Invalid block position %s", __func__, pos.ToString());
+        pos.nPos -= 8;
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+        try {
+            CMessageHeader::MessageStartChars blk_start;
+            unsigned int nSize;
+            filein >> FLATDATA(blk_start) >> nSize;
+            if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE))
+                return error("%s: Block magic mismatch for %s", __func__, pos.ToString());
+            if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                return error("%s: Block data is larger than maximum deserialization size for %s", __func__, pos.ToString());
+            block.resize(nSize);
+            filein.read((char*)block.data(), nSize);
+        } catch (const std::exception& e) {
+            return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // The header is cheap to check without deserializing the rest
+    try {
+        CBlockHeader header;
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, (const char*)block.data(), block.size());
+        reader >> header;
+        if (header.GetHash() != pindex->GetBlockHash())
+            return error("%s: GetHash() doesn't match index for %s at %s", __func__, pindex->ToString(), pindex->GetBlockPos().ToString());
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+    }
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1222,6 +1499,27 @@ bool CScriptCheck::operator()() {
     return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &error);
 }
 
+bool CPoWCheck::operator()() {
+    *phashPoW = pheader->GetHashYespower();
+    return true;
+}
+
+bool CBlockImportCheck::operator()() {
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    try {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, (const char*)pvchBlock->data(), pvchBlock->size());
+        reader >> *pblock;
+    } catch (const std::exception&) {
+        ppblock->reset();
+        return true;
+    }
+    *phashPoW = pblock->GetHashYespower();
+    CValidationState state;
+    CheckBlock(*pblock, state, *pconsensusParams, true, true, phashPoW);
+    *ppblock = pblock;
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1242,6 +1540,74 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+/** Record that all scripts of tx passed with flags, as CheckInputs does with cacheFullScriptStore */
+static void AddScriptExecutionCache(const CTransaction& tx, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+    scriptExecutionCache.insert(GetScriptExecutionCacheEntry(tx, flags));
+}
+
+/**
+ * The script checks of CheckInputs, without the script execution cache, so
+ * they can also be done without cs_main held. The inputs must have passed
+ * Consensus::CheckTxInputs.
+ */
+static bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const Coin& coin = inputs.AccessCoin(prevout);
+        assert(!coin.IsSpent());
+
+        // We very carefully only pass in things to CScriptCheck which
+        // are clearly committed to by tx' witness hash. This provides
+        // a sanity check that our caching is not introducing consensus
+        // failures through additional data in, eg, the coins being
+        // spent being checked as a part of CScriptCheck.
+        const CScript& scriptPubKey = coin.out.scriptPubKey;
+        const CAmount amount = coin.out.nValue;
+
+        // Verify signature
+        CScriptCheck check(scriptPubKey, amount, tx, i, flags, cacheSigStore, &txdata);
+        if (pvChecks) {
+            pvChecks->push_back(CScriptCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+                // Check whether the failure was caused by a
+                // non-mandatory script verification check, such as
+                // non-standard DER encodings or non-null dummy
+                // arguments; if so, don't trigger DoS protection to
+                // avoid splitting the network between upgraded and
+                // non-upgraded nodes.
+                CScriptCheck check2(scriptPubKey, amount, tx, i,
+                        flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
+                if (check2())
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+            }
+            // Failures of other flags indicate a transaction that is
+            // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+            // such nodes as they are not following the protocol. That
+            // said during an upgrade careful thought should be taken
+            // as to the correct behavior - we may want to continue
+            // peering with non-upgraded nodes even after soft-fork
+            // super-majority signaling has occurred.
+            return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+        }
+    }
+    return true;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1281,57 +1647,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // correct (ie that the transaction hash which is in tx's prevouts
             // properly commits to the scriptPubKey in the inputs view of that
             // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
             }
 
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const Coin& coin = inputs.AccessCoin(prevout);
-                assert(!coin.IsSpent());
-
-                // We very carefully only pass in things to CScriptCheck which
-                // are clearly committed to by tx' witness hash. This provides
-                // a sanity check that our caching is not introducing consensus
-                // failures through additional data in, eg, the coins being
-                // spent being checked as a part of CScriptCheck.
-                const CScript& scriptPubKey = coin.out.scriptPubKey;
-                const CAmount amount = coin.out.nValue;
-
-                // Verify signature
-                CScriptCheck check(scriptPubKey, amount, tx, i, flags, cacheSigStore, &txdata);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(scriptPubKey, amount, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
-                }
-            }
+            if (!CheckInputScripts(tx, state, inputs, flags, cacheSigStore, txdata, pvChecks))
+                return false;
 
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
@@ -1532,8 +1855,11 @@ void static FlushBlockFile(bool fFinalize = false)
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            // Mapped pages past the new end of the file would fault when read
+            blockFileMap.Invalidate(GetBlockPosFilename(posOld, "blk"));
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1550,12 +1876,41 @@ void static FlushBlockFile(bool fFinalize = false)
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/** Runs the checks of every other block of a run connected by ConnectTipPipeline */
+static CCheckQueue<CScriptCheck> scriptcheckqueuePipelined(128);
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadScriptCheckPipelined() {
+    RenameThread("bitcoin-scriptpl");
+    scriptcheckqueuePipelined.Thread();
+}
+
+void StartCoinsPrefetch(int nThreads)
+{
+    LOCK(cs_main);
+    coinsPrefetcher.reset();
+    if (nThreads > 0)
+        coinsPrefetcher.reset(new CCoinsPrefetcher(nThreads));
+}
+
+static CCheckQueue<CPoWCheck> powcheckqueue(4);
+
+void ThreadPoWCheck() {
+    RenameThread("bitcoin-powch");
+    powcheckqueue.Thread();
+}
+
+static CCheckQueue<CBlockImportCheck> importcheckqueue(1);
+
+void ThreadImportCheck() {
+    RenameThread("bitcoin-importch");
+    importcheckqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1644,11 +1999,29 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
- *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+/**
+ * A block applied to a coins view by ConnectBlockInputs, whose script checks
+ * may still be running on a check queue. ConnectBlockFinish waits for them and
+ * then records the block as connected.
+ */
+struct PendingBlockChecks
+{
+    CBlockUndo blockundo;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    //! Referenced by the script checks, so these have to outlive them
+    std::vector<PrecomputedTransactionData> txdata;
+    int nInputs = 0;
+    int64_t nTimeInputs = 0;
+    //! Declared last, so the checks are done before anything above is destroyed
+    std::unique_ptr<CCheckQueueControl<CScriptCheck> > control;
+};
+
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins,
+ *  queueing its script checks on queue. Validity checks that depend on the UTXO set are
+ *  also done, except for the scripts whose result is only known in ConnectBlockFinish. */
+static bool ConnectBlockInputs(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck,
+                  CCheckQueue<CScriptCheck>& queue, PendingBlockChecks& pending)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1753,20 +2126,22 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
-    CBlockUndo blockundo;
+    CBlockUndo& blockundo = pending.blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    pending.control.reset(new CCheckQueueControl<CScriptCheck>(fScriptChecks && nScriptCheckThreads ? &queue : nullptr));
+    CCheckQueueControl<CScriptCheck>& control = *pending.control;
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
-    int nInputs = 0;
+    int& nInputs = pending.nInputs;
     int64_t nSigOpsCost = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    std::vector<std::pair<uint256, CDiskTxPos> >& vPos = pending.vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
+    std::vector<PrecomputedTransactionData>& txdata = pending.txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    pending.nTimeInputs = nTime2;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1834,7 +2209,22 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    return true;
+}
+
+/** Wait for the script checks of a block applied by ConnectBlockInputs, and
+ *  unless fJustCheck, write its undo data and index entries. */
+static bool ConnectBlockFinish(CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view,
+                  const CChainParams& chainparams, bool fJustCheck, PendingBlockChecks& pending)
+{
+    AssertLockHeld(cs_main);
+    // Nothing to do for the genesis block, whose transactions are not connected
+    if (!pending.control)
+        return true;
+
+    const int nInputs = pending.nInputs;
+    const int64_t nTime2 = pending.nTimeInputs;
+    if (!pending.control->Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
@@ -1842,6 +2232,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     if (fJustCheck)
         return true;
 
+    const CBlockUndo& blockundo = pending.blockundo;
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
@@ -1862,7 +2254,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     }
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (!pblocktree->WriteTxIndex(pending.vPos))
             return AbortNode(state, "Failed to write transaction index");
 
     // add this block to the view's block chain
@@ -1877,6 +2269,17 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     return true;
 }
 
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
+ *  can fail if those validity checks fail (among other reasons). */
+static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+{
+    PendingBlockChecks pending;
+    return ConnectBlockInputs(block, state, pindex, view, chainparams, fJustCheck, scriptcheckqueue, pending) &&
+           ConnectBlockFinish(state, pindex, view, chainparams, fJustCheck, pending);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -1922,8 +2325,12 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         if (nLastSetChain == 0) {
             nLastSetChain = nNow;
         }
+        // Release the coins of a finished background write, or report its failure.
+        if (!pcoinsdbview->IsWriting() && !pcoinsdbview->WaitForPendingWrites())
+            return AbortNode(state, "Failed to write to coin database");
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // Coins still being written in the background count against the cache.
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pcoinsdbview->PendingMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -1933,10 +2340,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
+        bool fBackgroundFlush = gArgs.GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH);
         // Combine all conditions that result in a full cache flush.
-        fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+        fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheCritical || fFlushForPrune || (!fBackgroundFlush && (fCacheLarge || fPeriodicFlush));
+        // Otherwise let the coin database write the changes behind our back: the whole
+        // cache if it is large, or the modified coins only, keeping the cache warm.
+        bool fDoBackgroundFlush = !fDoFullFlush && fBackgroundFlush && (fCacheLarge || fPeriodicFlush || fPeriodicWrite) && !pcoinsdbview->IsWriting();
         // Write blocks and block index to disk.
-        if (fDoFullFlush || fPeriodicWrite) {
+        if (fDoFullFlush || fPeriodicWrite || fDoBackgroundFlush) {
             // Depend on nMinDiskSpace to ensure we can write block index
             if (!CheckDiskSpace(0))
                 return state.Error("out of disk space");
@@ -1965,6 +2376,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                 UnlinkPrunedFiles(setFilesToPrune);
             nLastWrite = nNow;
         }
+        // Coins being prefetched may have been read from the state about to be overwritten.
+        if (coinsPrefetcher && (fDoFullFlush || fDoBackgroundFlush))
+            coinsPrefetcher->Cancel();
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
         if (fDoFullFlush) {
             // Typical Coin structures on disk are around 48 bytes in size.
@@ -1978,6 +2392,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
+        } else if (fDoBackgroundFlush) {
+            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
+                return state.Error("out of disk space");
+            if (!pcoinsdbview->BatchWriteAsync(*pcoinsTip, fCacheLarge))
+                return AbortNode(state, "Failed to write to coin database");
+            if (fCacheLarge || fPeriodicFlush)
+                nLastFlush = nNow;
         }
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2195,42 +2616,103 @@ public:
 };
 
 /**
- * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
- *
- * The block is added to connectTrace if connection succeeds.
+ * A block being connected to chainActive: applied to a coins view layered over
+ * the chain state, or over the view of the block connected before it, while
+ * its script checks may still be running.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+struct PendingConnectTip
 {
-    assert(pindexNew->pprev == chainActive.Tip());
-    // Read block from disk.
+    CBlockIndex* pindex = nullptr;
+    std::shared_ptr<const CBlock> pblock;
+    std::unique_ptr<CCoinsViewCache> pview;
+    int64_t nTimeStart = 0;
+    int64_t nTimeLoaded = 0;
+    //! Whether the block itself failed to connect, as opposed to failing to be read
+    bool fConnectFailed = false;
+    //! Declared last, so the checks are done before the block and view are destroyed
+    PendingBlockChecks checks;
+};
+
+/**
+ * First half of ConnectTip: read the block unless it is given in pblock, and
+ * apply it to a new coins view over base with its script checks queued on
+ * queue. Only pending is modified, so the block can still be dropped.
+ */
+static bool ConnectTipStart(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexPrefetch, CCoinsViewCache* base, CCheckQueue<CScriptCheck>& queue, PendingConnectTip& pending)
+{
+    // Read block from disk, unless it was prefetched.
     int64_t nTime1 = GetTimeMicros();
-    std::shared_ptr<const CBlock> pthisBlock;
-    if (!pblock) {
+    pending.pindex = pindexNew;
+    pending.nTimeStart = nTime1;
+    std::shared_ptr<const CBlock> pblockPrefetched;
+    if (coinsPrefetcher)
+        pblockPrefetched = coinsPrefetcher->Finish(pindexNew->GetBlockHash(), *pcoinsTip);
+    if (pblock) {
+        pending.pblock = pblock;
+    } else if (pblockPrefetched) {
+        pending.pblock = pblockPrefetched;
+    } else {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
-        pthisBlock = pblockNew;
-    } else {
-        pthisBlock = pblock;
+        pending.pblock = pblockNew;
+    }
+    const CBlock& blockConnecting = *pending.pblock;
+    if (coinsPrefetcher) {
+        // Without coins read ahead, still look them up on several threads
+        if (!pblockPrefetched && blockConnecting.vtx.size() > 1) {
+            coinsPrefetcher->Start(pindexNew->GetBlockHash(), pending.pblock, pcoinsdbview, pcoinsTip);
+            coinsPrefetcher->Finish(pindexNew->GetBlockHash(), *pcoinsTip);
+        }
+        if (pindexPrefetch && (pindexPrefetch->nStatus & BLOCK_HAVE_DATA))
+            coinsPrefetcher->Start(pindexPrefetch->GetBlockHash(), pindexPrefetch->GetBlockPos(), chainparams.GetConsensus(), pcoinsdbview);
     }
-    const CBlock& blockConnecting = *pthisBlock;
-    // Apply the block atomically to the chain state.
+    // Apply the block to a view of its own, so it can be dropped if it turns out invalid.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
-    int64_t nTime3;
+    pending.nTimeLoaded = nTime2;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    pending.pview.reset(new CCoinsViewCache(base));
+    if (!ConnectBlockInputs(blockConnecting, state, pindexNew, *pending.pview, chainparams, false, queue, pending.checks)) {
+        pending.fConnectFailed = true;
+        return false;
+    }
+    // The block after this one may be applied on top of the view before it is finished
+    pending.pview->SetBestBlock(pindexNew->GetBlockHash());
+    return true;
+}
+
+/** Report a block that ConnectTipStart or ConnectTipFinish failed to connect */
+static bool ConnectTipFailed(CValidationState& state, const PendingConnectTip& pending)
+{
+    if (!pending.fConnectFailed)
+        return false;
+    GetMainSignals().BlockChecked(*pending.pblock, state);
+    if (state.IsInvalid())
+        InvalidBlockFound(pending.pindex, state);
+    return error("ConnectTip(): ConnectBlock %s failed", pending.pindex->GetBlockHash().ToString());
+}
+
+/**
+ * Second half of ConnectTip: wait for the script checks of the block, flush
+ * its view into the one below, and make it the tip.
+ */
+static bool ConnectTipFinish(CValidationState& state, const CChainParams& chainparams, PendingConnectTip& pending, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+{
+    CBlockIndex* pindexNew = pending.pindex;
+    assert(pindexNew->pprev == chainActive.Tip());
+    const CBlock& blockConnecting = *pending.pblock;
+    const int64_t nTime1 = pending.nTimeStart;
+    const int64_t nTime2 = pending.nTimeLoaded;
+    int64_t nTime3;
     {
-        CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
-        GetMainSignals().BlockChecked(blockConnecting, state);
-        if (!rv) {
-            if (state.IsInvalid())
-                InvalidBlockFound(pindexNew, state);
-            return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
+        if (!ConnectBlockFinish(state, pindexNew, *pending.pview, chainparams, false, pending.checks)) {
+            pending.fConnectFailed = true;
+            return ConnectTipFailed(state, pending);
         }
+        GetMainSignals().BlockChecked(blockConnecting, state);
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
-        bool flushed = view.Flush();
+        bool flushed = pending.pview->Flush();
         assert(flushed);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
@@ -2250,10 +2732,77 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
 
-    connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
+    connectTrace.BlockConnected(pindexNew, std::move(pending.pblock));
     return true;
 }
 
+/**
+ * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
+ * corresponding to pindexNew, to bypass loading it again from disk.
+ * pindexPrefetch, if not nullptr, is the block expected to be connected next,
+ * whose coins are read ahead while this one is connected.
+ *
+ * The block is added to connectTrace if connection succeeds.
+ */
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool, const CBlockIndex* pindexPrefetch)
+{
+    assert(pindexNew->pprev == chainActive.Tip());
+    PendingConnectTip pending;
+    if (!ConnectTipStart(state, chainparams, pindexNew, pblock, pindexPrefetch, pcoinsTip, scriptcheckqueue, pending))
+        return ConnectTipFailed(state, pending);
+    return ConnectTipFinish(state, chainparams, pending, connectTrace, disconnectpool);
+}
+
+/**
+ * Connects a run of blocks, overlapping the script checks of each block with
+ * applying the transactions of the next one. Blocks alternate between two
+ * check queues: while the checks of one block drain on its queue, the next
+ * block is applied to a coins view layered over the view of the first one, and
+ * its checks are queued on the other queue. A block only becomes the tip once
+ * its own checks have passed; if they fail, the block after it is dropped.
+ */
+class ConnectTipPipeline
+{
+private:
+    //! The block whose script checks are running, if any
+    std::unique_ptr<PendingConnectTip> pending;
+    unsigned int nStarted = 0;
+
+public:
+    /** Start connecting pindexNew, and finish the block before it. Returns false if either of them fails. */
+    bool Connect(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexPrefetch, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+    {
+        assert(pindexNew->pprev == (pending ? pending->pindex : chainActive.Tip()));
+        std::unique_ptr<PendingConnectTip> next(new PendingConnectTip());
+        CValidationState stateNext;
+        CCheckQueue<CScriptCheck>& queue = nStarted++ % 2 ? scriptcheckqueuePipelined : scriptcheckqueue;
+        bool fStarted = ConnectTipStart(stateNext, chainparams, pindexNew, pblock, pindexPrefetch, pending ? pending->pview.get() : pcoinsTip, queue, *next);
+        if (pending) {
+            std::unique_ptr<PendingConnectTip> current = std::move(pending);
+            if (!ConnectTipFinish(state, chainparams, *current, connectTrace, disconnectpool))
+                return false;
+            // The view of the finished block has been flushed into the chain state
+            if (fStarted)
+                next->pview->SetBackend(*pcoinsTip);
+        }
+        if (!fStarted) {
+            state = stateNext;
+            return ConnectTipFailed(state, *next);
+        }
+        pending = std::move(next);
+        return true;
+    }
+
+    /** Finish the block whose script checks are running, if any */
+    bool Finish(CValidationState& state, const CChainParams& chainparams, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+    {
+        if (!pending)
+            return true;
+        std::unique_ptr<PendingConnectTip> current = std::move(pending);
+        return ConnectTipFinish(state, chainparams, *current, connectTrace, disconnectpool);
+    }
+};
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2364,9 +2913,25 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         }
         nHeight = nTargetHeight;
 
-        // Connect new blocks.
+        // Connect new blocks. A run of them is connected with the script
+        // checks of each block overlapping the next one, before returning to
+        // release the lock.
+        ConnectTipPipeline pipeline;
+        const bool fPipeline = nPipelineConnectBlocks > 1 && nScriptCheckThreads && vpindexToConnect.size() > 1;
+        unsigned int nPipelined = 0;
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            const CBlockIndex* pindexNext = pindexConnect == pindexMostWork ? nullptr : pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+            const std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>();
+            bool fConnected;
+            if (fPipeline) {
+                fConnected = pipeline.Connect(state, chainparams, pindexConnect, pblockConnect, pindexNext, connectTrace, disconnectpool);
+                if (fConnected && ++nPipelined < nPipelineConnectBlocks && pindexConnect != vpindexToConnect.front())
+                    continue;
+                fConnected = fConnected && pipeline.Finish(state, chainparams, connectTrace, disconnectpool);
+            } else {
+                fConnected = ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool, pindexNext);
+            }
+            if (!fConnected) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2802,16 +3367,42 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+/** Look up the yespower hash of an already indexed header, to avoid recomputing it. */
+static bool GetKnownPoWHash(const CBlockHeader& block, uint256& hashPoW)
+{
+    LOCK(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+    if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_POW_HASH))
+        return false;
+    hashPoW = mi->second->hashPoW;
+    return true;
+}
+
+/**
+ * Context-independent header checks. If phashPoW points to a non-null hash, it is taken
+ * as the yespower hash of the header; otherwise the hash is computed and stored there.
+ */
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, uint256* phashPoW = nullptr)
 {
+    if (!fCheckPOW)
+        return true;
+
+    // The yespower hash is expensive; headers we have indexed before carry it along.
+    uint256 hashPoW = phashPoW ? *phashPoW : uint256();
+    if (hashPoW.IsNull() && !GetKnownPoWHash(block, hashPoW))
+        hashPoW = block.GetHashYespower();
+
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHashYespower(), block.nBits, consensusParams))
+    if (!CheckProofOfWork(hashPoW, block.nBits, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
+    if (phashPoW)
+        *phashPoW = hashPoW;
+
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, uint256* phashPoW)
 {
     // These are checks that are independent of context.
 
@@ -2820,7 +3411,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW, phashPoW))
         return false;
 
     // Check the merkle root.
@@ -3059,13 +3650,18 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/**
+ * Accept a block header into mapBlockIndex. If phashPoW points to a non-null hash it is
+ * used as the (precomputed) yespower hash of the header instead of hashing it here.
+ */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const uint256* phashPoW = nullptr)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
+    uint256 hashPoW = phashPoW ? *phashPoW : uint256();
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3078,10 +3674,8 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
-            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
-
-        // Get prev block index
+        // Run the cheap context checks first, so a bogus header costs a few
+        // lookups rather than a yespower hash.
         CBlockIndex* pindexPrev = nullptr;
         BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
@@ -3092,6 +3686,9 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (!ContextualCheckBlockHeader(block, state, chainparams, pindexPrev, GetAdjustedTime()))
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, &hashPoW))
+            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+
         if (!pindexPrev->IsValid(BLOCK_VALID_SCRIPTS)) {
             for (const CBlockIndex* failedit : g_failed_blocks) {
                 if (pindexPrev->GetAncestor(failedit->nHeight) == failedit) {
@@ -3107,8 +3704,14 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             }
         }
     }
-    if (pindex == nullptr)
+    if (pindex == nullptr) {
         pindex = AddToBlockIndex(block);
+        if (!hashPoW.IsNull()) {
+            // Remember the verified PoW hash so the header is never hashed again
+            pindex->hashPoW = hashPoW;
+            pindex->nStatus |= BLOCK_HAVE_POW_HASH;
+        }
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3118,29 +3721,116 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+/**
+ * Return the end of the prefix of headers[nBegin, nEnd) that passes the checks
+ * AcceptBlockHeader runs before the proof of work: a known and valid parent
+ * (or the previous header), and ContextualCheckBlockHeader. Headers that are
+ * not indexed yet are linked through temporary index entries for this.
+ */
+static size_t PrefilterHeaders(const std::vector<CBlockHeader>& headers, size_t nBegin, size_t nEnd, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    const int64_t nAdjustedTime = GetAdjustedTime();
+    std::vector<CBlockIndex> vIndexNew;
+    vIndexNew.reserve(nEnd - nBegin);
+    const CBlockIndex* pindexPrev = nullptr;
+    uint256 hashPrev;
+    for (size_t i = nBegin; i < nEnd; i++) {
+        const CBlockHeader& header = headers[i];
+        const uint256 hash = header.GetHash();
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end()) {
+            pindexPrev = mi->second;
+            hashPrev = hash;
+            continue;
+        }
+
+        if (pindexPrev == nullptr || header.hashPrevBlock != hashPrev) {
+            mi = mapBlockIndex.find(header.hashPrevBlock);
+            if (mi == mapBlockIndex.end())
+                return i;
+            pindexPrev = mi->second;
+        }
+        CValidationState state;
+        if ((pindexPrev->nStatus & BLOCK_FAILED_MASK) || !ContextualCheckBlockHeader(header, state, chainparams, pindexPrev, nAdjustedTime))
+            return i;
+
+        vIndexNew.emplace_back(header);
+        CBlockIndex& index = vIndexNew.back();
+        index.pprev = const_cast<CBlockIndex*>(pindexPrev);
+        index.nHeight = pindexPrev->nHeight + 1;
+        pindexPrev = &index;
+        hashPrev = hash;
+    }
+    return nEnd;
+}
+
+/**
+ * Compute the yespower hashes of headers[nBegin, nEnd) that are not in mapBlockIndex yet,
+ * spread over the PoW check threads. Headers from the first one failing PrefilterHeaders
+ * on are not hashed. Entries of vHashPoW for headers not hashed stay null.
+ * Must be called without cs_main held, so hashing does not block validation.
+ */
+static void CalculateHeadersPoW(const std::vector<CBlockHeader>& headers, size_t nBegin, size_t nEnd, std::vector<uint256>& vHashPoW, const CChainParams& chainparams)
+{
+    std::vector<CPoWCheck> vChecks;
+    {
+        LOCK(cs_main);
+        nEnd = PrefilterHeaders(headers, nBegin, nEnd, chainparams);
+        for (size_t i = nBegin; i < nEnd; i++) {
+            if (!mapBlockIndex.count(headers[i].GetHash()))
+                vChecks.emplace_back(headers[i], &vHashPoW[i]);
+        }
+    }
+
+    if (nScriptCheckThreads == 0 || vChecks.size() < 2) {
+        for (CPoWCheck& check : vChecks)
+            check();
+        return;
+    }
+
+    CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 // Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid, unsigned int* pnPoWBudget)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
-    {
+
+    // Hash the headers in windows of a few per thread before linking them, so an
+    // invalid header early in the sequence wastes at most one window of hashing.
+    // With a budget, the first window is the budget and it doubles with every
+    // window that passes, so a peer only gets parallel hashing once its
+    // headers have proven valid.
+    const size_t nMaxWindow = std::max(1, nScriptCheckThreads) * POW_CHECK_HEADERS_PER_THREAD;
+    size_t nWindow = pnPoWBudget ? std::min<size_t>(std::max(1u, *pnPoWBudget), nMaxWindow) : nMaxWindow;
+    std::vector<uint256> vHashPoW(headers.size());
+    for (size_t nBegin = 0; nBegin < headers.size(); nBegin += nWindow, nWindow = std::min(2 * nWindow, nMaxWindow)) {
+        const size_t nEnd = std::min(headers.size(), nBegin + nWindow);
+        CalculateHeadersPoW(headers, nBegin, nEnd, vHashPoW, chainparams);
+
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = nBegin; i < nEnd; i++) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
-                if (first_invalid) *first_invalid = header;
+            if (!AcceptBlockHeader(headers[i], state, chainparams, &pindex, &vHashPoW[i])) {
+                if (first_invalid) *first_invalid = headers[i];
+                if (pnPoWBudget) *pnPoWBudget = 1;
                 return false;
             }
             if (ppindex) {
                 *ppindex = pindex;
             }
         }
+        if (pnPoWBudget) *pnPoWBudget = std::min(2 * nWindow, nMaxWindow);
     }
     NotifyHeaderTip();
     return true;
 }
 
-/** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk. phashPoW is as in AcceptBlockHeader. */
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* phashPoW = nullptr)
 {
     const CBlock& block = *pblock;
 
@@ -3150,7 +3840,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, phashPoW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3331,6 +4021,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMap.Invalidate(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3916,6 +4607,8 @@ bool RewindBlockIndex(const CChainParams& params)
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
+    if (coinsPrefetcher)
+        coinsPrefetcher->Cancel();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(nullptr);
     pindexBestInvalid = nullptr;
@@ -3938,6 +4631,7 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    blockFileMap.Clear();
 }
 
 bool LoadBlockIndex(const CChainParams& chainparams)
@@ -3996,10 +4690,86 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return true;
 }
 
+/** Disk positions and known yespower hashes of blocks read before their parent, by parent hash */
+typedef std::multimap<uint256, std::pair<CDiskBlockPos, uint256>> BlocksUnknownParentMap;
+
+/**
+ * Accept a block read from a block file at *dbp (or from an external file if dbp
+ * is nullptr), then any blocks read before that were waiting for it. Blocks with
+ * an unknown parent are queued in mapBlocksUnknownParent. phashPoW may point to
+ * the block's yespower hash. Returns false if importing has to stop.
+ */
+static bool ImportBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* dbp, const uint256* phashPoW, BlocksUnknownParentMap& mapBlocksUnknownParent, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, std::make_pair(*dbp, phashPoW ? *phashPoW : uint256())));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr, phashPoW))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<BlocksUnknownParentMap::iterator, BlocksUnknownParentMap::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            BlocksUnknownParentMap::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second.first, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                const uint256& hashPoW = it->second.second;
+                if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second.first, nullptr, hashPoW.IsNull() ? nullptr : &hashPoW))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    static BlocksUnknownParentMap mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
@@ -4038,69 +4808,11 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
+                blkdat >> *pblock;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
+                if (!ImportBlock(chainparams, pblock, dbp, nullptr, mapBlocksUnknownParent, nLoaded))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -4113,6 +4825,60 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+bool ReindexBlockFiles(const CChainParams& chainparams)
+{
+    BlocksUnknownParentMap mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+    int nLoaded = 0;
+    int nFile = -1;
+
+    // Reading the files, checking batches of blocks on the import check
+    // threads and accepting them in file order all overlap.
+    const size_t nBatchSize = std::max(1, nScriptCheckThreads) * IMPORT_CHECK_BLOCKS_PER_THREAD;
+    CBlockFileReader reader(chainparams.MessageStart(), 0, REINDEX_READ_AHEAD_BYTES);
+    std::vector<CBlockFileReader::Entry> vEntries;
+    bool fContinue = true;
+    while (fContinue && reader.Read(vEntries, nBatchSize)) {
+        boost::this_thread::interruption_point();
+
+        std::vector<std::shared_ptr<CBlock>> vBlocks(vEntries.size());
+        std::vector<uint256> vHashPoW(vEntries.size());
+        std::vector<CBlockImportCheck> vChecks;
+        vChecks.reserve(vEntries.size());
+        for (size_t i = 0; i < vEntries.size(); i++)
+            vChecks.emplace_back(vEntries[i].vchBlock, &vBlocks[i], &vHashPoW[i], chainparams.GetConsensus());
+        if (nScriptCheckThreads == 0 || vChecks.size() < 2) {
+            for (CBlockImportCheck& check : vChecks)
+                check();
+        } else {
+            CCheckQueueControl<CBlockImportCheck> control(&importcheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+        }
+
+        for (size_t i = 0; i < vEntries.size(); i++) {
+            boost::this_thread::interruption_point();
+            if (vEntries[i].pos.nFile != nFile) {
+                nFile = vEntries[i].pos.nFile;
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            }
+            if (!vBlocks[i]) {
+                LogPrintf("%s: Deserialize error at %s\n", __func__, vEntries[i].pos.ToString());
+                continue;
+            }
+            if (!ImportBlock(chainparams, vBlocks[i], &vEntries[i].pos, &vHashPoW[i], mapBlocksUnknownParent, nLoaded)) {
+                fContinue = false;
+                break;
+            }
+        }
+    }
+    std::string strError = reader.GetError();
+    if (!strError.empty())
+        AbortNode(std::string("System error: ") + strError);
+    LogPrintf("Loaded %i blocks from block files in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4325,72 +5091,292 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION_NO_STATE = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+//! Number of entries in each chunk of mempool.dat, which are deserialized in parallel
+static const size_t MEMPOOL_DUMP_CHUNK_SIZE = 1000;
 
-bool LoadMempool(void)
+namespace {
+
+/**
+ * A mempool entry as stored in mempool.dat. Besides the transaction, its time
+ * and fee delta, it holds what the mempool computed from the coins it spends,
+ * which must match when a trusted file is added back (see AddMempoolDumpEntry).
+ */
+struct MempoolDumpEntry
+{
+    CTransactionRef tx;
+    int64_t nTime;
+    int64_t nFeeDelta;
+    CAmount nFee;
+    bool fSpendsCoinbase;
+    int64_t nSigOpCost;
+    int32_t nLockHeight;
+    int64_t nLockTime;
+    uint256 hashLockMaxInputBlock;
+
+    MempoolDumpEntry() {}
+
+    explicit MempoolDumpEntry(const CTxMemPoolEntry& entry) :
+        tx(entry.GetSharedTx()), nTime(entry.GetTime()), nFeeDelta(entry.GetModifiedFee() - entry.GetFee()), nFee(entry.GetFee()),
+        fSpendsCoinbase(entry.GetSpendsCoinbase()), nSigOpCost(entry.GetSigOpCost()),
+        nLockHeight(entry.GetLockPoints().height), nLockTime(entry.GetLockPoints().time)
+    {
+        if (entry.GetLockPoints().maxInputBlock)
+            hashLockMaxInputBlock = entry.GetLockPoints().maxInputBlock->GetBlockHash();
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFeeDelta);
+        READWRITE(nFee);
+        READWRITE(fSpendsCoinbase);
+        READWRITE(nSigOpCost);
+        READWRITE(nLockHeight);
+        READWRITE(nLockTime);
+        READWRITE(hashLockMaxInputBlock);
+    }
+};
+
+} // namespace
+
+/** Load a mempool.dat without the mempool state of its entries, validating each of them */
+static bool LoadMempoolNoState(CAutoFile& file)
 {
     const CChainParams& chainparams = Params();
     int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
-    FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
-    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
-    if (file.IsNull()) {
-        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
-        return false;
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    uint64_t num;
+    file >> num;
+    while (num--) {
+        CTransactionRef tx;
+        int64_t nTime;
+        int64_t nFeeDelta;
+        file >> tx;
+        file >> nTime;
+        file >> nFeeDelta;
+
+        CAmount amountdelta = nFeeDelta;
+        if (amountdelta) {
+            mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        }
+        CValidationState state;
+        if (nTime + nExpiryTimeout > nNow) {
+            LOCK(cs_main);
+            AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, true, nullptr, nTime, nullptr, false, 0);
+            if (state.IsValid()) {
+                ++count;
+            } else {
+                ++failed;
+            }
+        } else {
+            ++skipped;
+        }
+        if (ShutdownRequested())
+            return false;
     }
+    std::map<uint256, CAmount> mapDeltas;
+    file >> mapDeltas;
+
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.second);
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    return true;
+}
+
+/**
+ * Add an entry of a mempool.dat written at the current tip, with the script
+ * flags in use now, to the mempool without checking its scripts again.
+ * Everything else is checked as in AcceptToMemoryPool: the coins spent are
+ * looked up and the fee, sigop cost and lock points computed from them. If
+ * any of those differ from what the file says, the file can't be trusted and
+ * the entry is rejected.
+ */
+static bool AddMempoolDumpEntry(const CChainParams& chainparams, const MempoolDumpEntry& dumpEntry, CValidationState& state, std::vector<COutPoint>& coins_to_uncache)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    MemPoolAccept ws(dumpEntry.tx);
+    if (!PreChecks(chainparams, mempool, state, ws, true, nullptr, dumpEntry.nTime, 0, coins_to_uncache))
+        return false;
+
+    const CTxMemPoolEntry& entry = *ws.entry;
+    const LockPoints& lp = entry.GetLockPoints();
+    uint256 hashLockMaxInputBlock;
+    if (lp.maxInputBlock)
+        hashLockMaxInputBlock = lp.maxInputBlock->GetBlockHash();
+    if (entry.GetFee() != dumpEntry.nFee || entry.GetSigOpCost() != dumpEntry.nSigOpCost ||
+        entry.GetSpendsCoinbase() != dumpEntry.fSpendsCoinbase || lp.height != dumpEntry.nLockHeight ||
+        lp.time != dumpEntry.nLockTime || hashLockMaxInputBlock != dumpEntry.hashLockMaxInputBlock)
+        return state.Invalid(false, REJECT_INVALID, "mempool-dump-mismatch");
+
+    return Finalize(mempool, state, ws, nullptr, false);
+}
 
+/**
+ * Load a mempool.dat with the mempool state of its entries. The chunks of the
+ * file are deserialized in parallel. If the file was written at the current
+ * tip, with the script flags in use now, and -persistmempooltrusted is on,
+ * its entries are then added without checking their scripts again; otherwise
+ * they are validated in batches, with their scripts checked in parallel and
+ * without cs_main held.
+ */
+static bool LoadMempoolWithState(CAutoFile& file)
+{
+    const CChainParams& chainparams = Params();
+    int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
     int64_t count = 0;
+    int64_t trusted = 0;
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
 
-    try {
-        uint64_t version;
-        file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+    uint256 hashBestBlock;
+    uint32_t nScriptVerifyFlags;
+    uint64_t nChunks;
+    file >> hashBestBlock;
+    file >> nScriptVerifyFlags;
+    file >> nChunks;
+
+    // Deserialize the chunks in parallel while they are read. The queue is
+    // declared after what its jobs write to, so that if reading the file
+    // throws, its destructor finishes the jobs before those are destroyed.
+    std::deque<std::vector<MempoolDumpEntry> > vChunks;
+    std::atomic<bool> fCorrupt(false);
+    CTxAcceptQueue queue(std::max(1, nScriptCheckThreads), std::numeric_limits<size_t>::max());
+    for (uint64_t n = 0; n < nChunks; n++) {
+        std::shared_ptr<std::vector<unsigned char> > pvch = std::make_shared<std::vector<unsigned char> >();
+        file >> *pvch;
+        vChunks.emplace_back();
+        std::vector<MempoolDumpEntry>* pvEntries = &vChunks.back();
+        queue.Add([pvch, pvEntries, &fCorrupt] {
+            try {
+                CDataStream ss(*pvch, SER_DISK, CLIENT_VERSION);
+                ss >> *pvEntries;
+            } catch (const std::exception&) {
+                fCorrupt = true;
+            }
+        });
+    }
+    std::map<uint256, CAmount> mapDeltas;
+    file >> mapDeltas;
+    queue.Wait();
+    if (fCorrupt)
+        throw std::runtime_error("corrupt chunk");
+
+    bool fTrusted = gArgs.GetBoolArg("-persistmempooltrusted", DEFAULT_PERSIST_MEMPOOL_TRUSTED) &&
+                    nScriptVerifyFlags == GetMempoolScriptVerifyFlags(chainparams);
+
+    // Add the entries of a trusted file a chunk at a time, and leave the rest
+    // for the batches below
+    std::vector<const MempoolDumpEntry*> vToValidate;
+    for (const std::vector<MempoolDumpEntry>& vEntries : vChunks) {
+        std::vector<CTransactionRef> vAdded;
+        {
+            LOCK(cs_main);
+            fTrusted = fTrusted && chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashBestBlock;
+            {
+                LOCK(mempool.cs);
+                for (const MempoolDumpEntry& dumpEntry : vEntries) {
+                    if (dumpEntry.nFeeDelta) {
+                        mempool.PrioritiseTransaction(dumpEntry.tx->GetHash(), dumpEntry.nFeeDelta);
+                    }
+                    if (dumpEntry.nTime + nExpiryTimeout <= nNow) {
+                        ++skipped;
+                    } else if (!fTrusted) {
+                        vToValidate.push_back(&dumpEntry);
+                    } else {
+                        CValidationState state;
+                        std::vector<COutPoint> coins_to_uncache;
+                        if (AddMempoolDumpEntry(chainparams, dumpEntry, state, coins_to_uncache)) {
+                            vAdded.push_back(dumpEntry.tx);
+                        } else {
+                            for (const COutPoint& hashTx : coins_to_uncache)
+                                pcoinsTip->Uncache(hashTx);
+                            ++failed;
+                        }
+                    }
+                }
+            }
+            CValidationState stateDummy;
+            FlushStateToDisk(chainparams, stateDummy, FLUSH_STATE_PERIODIC);
+        }
+        for (const CTransactionRef& ptx : vAdded)
+            GetMainSignals().TransactionAddedToMempool(ptx);
+        trusted += vAdded.size();
+        if (ShutdownRequested())
             return false;
+    }
+    LogPrint(BCLog::MEMPOOL, "Added %i mempool transactions from disk without checking their scripts in %.2fms\n", trusted, (GetTimeMicros() - nStart) * 0.001);
+
+    for (size_t nBatchStart = 0; nBatchStart < vToValidate.size(); nBatchStart += MEMPOOL_DUMP_CHUNK_SIZE) {
+        size_t nBatchEnd = std::min(vToValidate.size(), nBatchStart + MEMPOOL_DUMP_CHUNK_SIZE);
+        std::vector<CTransactionRef> vtx;
+        std::vector<int64_t> vAcceptTime;
+        for (size_t i = nBatchStart; i < nBatchEnd; i++) {
+            vtx.push_back(vToValidate[i]->tx);
+            vAcceptTime.push_back(vToValidate[i]->nTime);
         }
-        uint64_t num;
-        file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
-            }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
+        std::vector<CTxAcceptResult> vResults;
+        AcceptToMemoryPoolBatchWithTime(chainparams, mempool, vtx, vAcceptTime, vResults, true, &queue);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            // Transactions spending outputs of others in the same batch
+            if (vResults[i].fMissingInputs) {
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, true, nullptr, nTime, nullptr, false, 0);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    ++failed;
-                }
+                vResults[i].state = CValidationState();
+                vResults[i].fAccepted = AcceptToMemoryPoolWithTime(chainparams, mempool, vResults[i].state, vtx[i], true, nullptr, vAcceptTime[i], nullptr, false, 0);
+            }
+            if (vResults[i].fAccepted) {
+                ++count;
             } else {
-                ++skipped;
+                ++failed;
             }
-            if (ShutdownRequested())
-                return false;
         }
-        std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
+        if (ShutdownRequested())
+            return false;
+    }
+
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.second);
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes (%i trusted), %i failed, %i expired\n", count + trusted, trusted, failed, skipped);
+    return true;
+}
+
+bool LoadMempool(void)
+{
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
 
-        for (const auto& i : mapDeltas) {
-            mempool.PrioritiseTransaction(i.first, i.second);
+    try {
+        uint64_t version;
+        file >> version;
+        if (version == MEMPOOL_DUMP_VERSION_NO_STATE) {
+            return LoadMempoolNoState(file);
+        } else if (version == MEMPOOL_DUMP_VERSION) {
+            return LoadMempoolWithState(file);
         }
+        return false;
     } catch (const std::exception& e) {
         LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
         return false;
     }
-
-    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
-    return true;
 }
 
 void DumpMempool(void)
@@ -4398,14 +5384,29 @@ void DumpMempool(void)
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::vector<MempoolDumpEntry> vEntries;
+    uint256 hashBestBlock;
+    uint32_t nScriptVerifyFlags;
 
     {
-        LOCK(mempool.cs);
+        LOCK2(cs_main, mempool.cs);
+        if (chainActive.Tip())
+            hashBestBlock = chainActive.Tip()->GetBlockHash();
+        nScriptVerifyFlags = GetMempoolScriptVerifyFlags(Params());
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
-        vinfo = mempool.infoAll();
+        // Parents have fewer ancestors than their children, so come first
+        std::vector<CTxMemPool::txiter> vIters;
+        vIters.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vIters.push_back(it);
+        std::sort(vIters.begin(), vIters.end(), [](const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) {
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        });
+        vEntries.reserve(vIters.size());
+        for (const CTxMemPool::txiter& it : vIters)
+            vEntries.emplace_back(*it);
     }
 
     int64_t mid = GetTimeMicros();
@@ -4420,14 +5421,19 @@ void DumpMempool(void)
 
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
-
-        file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetHash());
+        file << hashBestBlock;
+        file << nScriptVerifyFlags;
+
+        uint64_t nChunks = (vEntries.size() + MEMPOOL_DUMP_CHUNK_SIZE - 1) / MEMPOOL_DUMP_CHUNK_SIZE;
+        file << nChunks;
+        for (size_t nChunkStart = 0; nChunkStart < vEntries.size(); nChunkStart += MEMPOOL_DUMP_CHUNK_SIZE) {
+            std::vector<MempoolDumpEntry> vChunk(vEntries.begin() + nChunkStart, vEntries.begin() + std::min(vEntries.size(), nChunkStart + MEMPOOL_DUMP_CHUNK_SIZE));
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << vChunk;
+            file << std::vector<unsigned char>(ss.begin(), ss.end());
         }
+        for (const MempoolDumpEntry& dumpEntry : vEntries)
+            mapDeltas.erase(dumpEntry.tx->GetHash());
 
         file << mapDeltas;
         FileCommit(file.Get());
@@ -12,6 +12,7 @@
 
 #include "amount.h"
 #include "coins.h"
+#include "consensus/validation.h"
 #include "fs.h"
 #include "protocol.h" // For CMessageHeader::MessageStartChars
 #include "policy/feerate.h"
@@ -22,6 +23,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <list>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -40,6 +42,7 @@ class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
+class CTxAcceptQueue;
 class CValidationState;
 struct ChainTxData;
 
@@ -80,10 +83,24 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
+/** Number of headers per worker thread that are hashed in parallel before they are connected */
+static const unsigned int POW_CHECK_HEADERS_PER_THREAD = 16;
+/** Number of blocks per worker thread that are deserialized and checked in parallel during -reindex */
+static const unsigned int IMPORT_CHECK_BLOCKS_PER_THREAD = 16;
+/** Maximum size of the blocks read ahead from the block files during -reindex */
+static const size_t REINDEX_READ_AHEAD_BYTES = 64 << 20;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -prefetchthreads default (number of threads reading the coins of the next block, 0 = off) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of coin prefetching threads allowed */
+static const int MAX_PREFETCH_THREADS = 64;
+/** -pipelineconnect default (number of blocks connected with overlapping script checks before releasing cs_main, 0 = off) */
+static const unsigned int DEFAULT_PIPELINE_CONNECT_BLOCKS = 8;
+/** Maximum for -pipelineconnect */
+static const unsigned int MAX_PIPELINE_CONNECT_BLOCKS = 32;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 256;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -105,6 +122,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Default for -backgroundflush, writing the coin database from a background thread */
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -137,6 +156,8 @@ static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistmempooltrusted */
+static const bool DEFAULT_PERSIST_MEMPOOL_TRUSTED = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -172,6 +193,8 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+/** Number of blocks connected at a time with their script checks overlapping, see -pipelineconnect */
+extern unsigned int nPipelineConnectBlocks;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -252,8 +275,10 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  * @param[in]  chainparams The params for the chain we want to connect to
  * @param[out] ppindex If set, the pointer will be set to point to the last new block index object for the given headers
  * @param[out] first_invalid First header that fails validation, if one exists
+ * @param[in,out] pnPoWBudget If set, the number of headers to hash before any is accepted,
+ *                 raised as headers pass and reset to 1 when one fails (per-peer state)
  */
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr, unsigned int* pnPoWBudget=nullptr);
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -263,6 +288,8 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import the blocks of our own block files (-reindex), checking them on the import check threads */
+bool ReindexBlockFiles(const CChainParams& chainparams);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -272,8 +299,16 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Start reading the coins of blocks about to be connected on nThreads threads (0 = stop) */
+void StartCoinsPrefetch(int nThreads);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the script checking thread for the second queue of -pipelineconnect */
+void ThreadScriptCheckPipelined();
+/** Run an instance of the header PoW hashing thread */
+void ThreadPoWCheck();
+/** Run an instance of the -reindex block checking thread */
+void ThreadImportCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -310,6 +345,29 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = nullptr,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** The outcome of accepting one transaction of a batch, see AcceptToMemoryPoolBatch */
+struct CTxAcceptResult
+{
+    CValidationState state;
+    bool fAccepted = false;
+    bool fMissingInputs = false;
+    //! Transactions replaced by this one
+    std::list<CTransactionRef> lRemovedTxn;
+};
+
+/**
+ * AcceptToMemoryPool for a batch of transactions, for callers that don't hold
+ * cs_main: the checks against the chain state and mempool are done for all of
+ * them under one acquisition of the locks, and their scripts are then checked
+ * in parallel and without the locks held, on the threads of queue (or by the
+ * caller if queue is null). Those checks are repeated before each transaction
+ * is added. vResults gets one entry per
+ * transaction in vtx. Transactions spending outputs of others in the same
+ * batch come back with fMissingInputs set.
+ */
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, std::vector<CTxAcceptResult>& vResults,
+                             bool fLimitFree, CTxAcceptQueue* queue);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -393,6 +451,60 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the yespower hashing of one block header, so that a
+ * batch of headers can be hashed in parallel on a CCheckQueue. The hash is
+ * only computed here; comparing it against nBits is left to CheckBlockHeader.
+ */
+class CPoWCheck
+{
+private:
+    const CBlockHeader *pheader;
+    uint256 *phashPoW;
+
+public:
+    CPoWCheck(): pheader(nullptr), phashPoW(nullptr) {}
+    CPoWCheck(const CBlockHeader& headerIn, uint256* phashPoWIn) :
+        pheader(&headerIn), phashPoW(phashPoWIn) { }
+
+    bool operator()();
+
+    void swap(CPoWCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(phashPoW, check.phashPoW);
+    }
+};
+
+/**
+ * Closure representing the context-free part of importing a block read from
+ * a block file: deserializing it, hashing its header with yespower and
+ * running CheckBlock, which caches a success in the block. *ppblock is left
+ * null if the block cannot be deserialized; failed checks are left for
+ * AcceptBlock to run again and report.
+ */
+class CBlockImportCheck
+{
+private:
+    const std::vector<unsigned char> *pvchBlock;
+    std::shared_ptr<CBlock> *ppblock;
+    uint256 *phashPoW;
+    const Consensus::Params *pconsensusParams;
+
+public:
+    CBlockImportCheck(): pvchBlock(nullptr), ppblock(nullptr), phashPoW(nullptr), pconsensusParams(nullptr) {}
+    CBlockImportCheck(const std::vector<unsigned char>& vchBlockIn, std::shared_ptr<CBlock>* ppblockIn, uint256* phashPoWIn, const Consensus::Params& consensusParamsIn) :
+        pvchBlock(&vchBlockIn), ppblock(ppblockIn), phashPoW(phashPoWIn), pconsensusParams(&consensusParamsIn) { }
+
+    bool operator()();
+
+    void swap(CBlockImportCheck &check) {
+        std::swap(pvchBlock, check.pvchBlock);
+        std::swap(ppblock, check.ppblock);
+        std::swap(phashPoW, check.phashPoW);
+        std::swap(pconsensusParams, check.pconsensusParams);
+    }
+};
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
@@ -400,11 +512,13 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block at pindex as stored on disk, which is its network serialization with witness data */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Context-independent validity checks. If phashPoW points to a non-null hash, it is taken as the yespower hash of the header. */
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, uint256* phashPoW = nullptr);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);